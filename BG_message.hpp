@@ -11,6 +11,7 @@
  *
  * We will use two buffers, because "write_func" function called by "WriteOut" may call "Append" itself
  * written while other is being sent.
+ * Single producer only, see BG_messageMT.hpp for many threads or interrupt levels.
  */
 
 
@@ -22,6 +23,7 @@
 #include <stdarg.h>
 /// @endcond
 #include "IO.hpp"
+#include "Format.hpp"
 
 namespace avp {
   template<write_type_func write_func, size_t BufferSize, char OverrunIndicator = '~'>
@@ -52,6 +54,17 @@ namespace avp {
           } // vAppend
           STOP_IGNORING_WARNING
 
+          /// formats right into the buffer, truncates like vAppend
+          template<class Fmt, typename... Args>
+          bool Format(const Args &... a) {
+            const size_t Space = BufferSize-FilledBytes;
+            if(Space == 0) return true;
+            const size_t Size = formatting::Call<Fmt, Args...>(a...).Write(Chars+FilledBytes,Space);
+            if(Size >= Space) Chars[(FilledBytes = BufferSize)-1] = OverrunIndicator;
+            else FilledBytes += Size;
+            return true;
+          } // Format
+
 
           /**
           @brief this function should be called repeatedly as a part of main program loop to maintain background message facility.
@@ -69,6 +82,9 @@ namespace avp {
       //! does not do any immediate writing to a serial port, so does not call bg_loop
       static bool vAppend(const char *format, va_list ap) { return Buffer[CurBuffer].vAppend(format,ap); }
       static PRINTF_WRAPPER(bool,printf,vAppend);
+      /// printf with format parsed at compile time, see Format.hpp
+      template<class Fmt, typename... Args>
+      static bool format(Fmt, const Args &... a) { return Buffer[CurBuffer].template Format<Fmt>(a...); }
 
       static void WriteOut() { Buffer[1 - (CurBuffer = 1 - CurBuffer)].WriteOut(); } // switches buffers as well
   }; // class BG_message
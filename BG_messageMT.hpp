@@ -0,0 +1,246 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief BG_message for many producers: every thread or interrupt priority level appends into its own buffer with no
+  locks, WriteOut merges messages of all buffers in timestamp order.
+
+  BG_message has one pair of buffers, so two producers, or a producer and WriteOut swapping buffers, may lose or mix
+  messages. Here every producer has single-producer single-consumer ring of messages, each one stamped with micros().
+  Threads get their rings on first append and give them back on exit. Interrupt handlers use fixed rings by
+  index, the first NumFixed ones, which are never given to threads:
+  @code
+    typedef avp::BG_messageMT<MyPort::write, 512, 6, 2> Diag; // 2 ISR levels, up to 4 threads
+    Diag::printf("queue %u\n", n); // thread
+    Diag::printfFrom<0>("overrun %u\n", Count); // UART ISR
+    Diag::WriteOut(); // in loop
+  @endcode
+  A message which does not fit into its ring is dropped, the next message of this producer which fits starts with
+  OverrunIndicator. Messages of threads which found no free ring are dropped and counted, see GetNoRingDrops().
+  Message is never split and never mixed with others. Text is formatted on stack into a buffer of BufferSize bytes. WriteOut copies messages into single output
+  buffer of BufferSize and writes it with single write_func call, messages stay in rings if it fails.
+  @note on hosts ring indexes are accessed atomically, on MCU they should be of size the CPU reads at once
+  */
+
+#ifndef AVP_BGMESSAGEMT_HPP_INCLUDED
+#define AVP_BGMESSAGEMT_HPP_INCLUDED
+
+/// @cond
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+/// @endcond
+#include "IO.hpp"
+#include "Format.hpp"
+#include "millis_micros.hpp"
+
+#ifndef AVP_BG_MESSAGE_ATOMIC
+# if defined(__linux__) || defined(_WIN32) || defined(__APPLE__)
+#  define AVP_BG_MESSAGE_ATOMIC 1
+# else
+#  define AVP_BG_MESSAGE_ATOMIC 0
+# endif
+#endif
+
+namespace avp {
+  /**
+   * @tparam BufferSize - size of every producer ring and of output buffer, power of 2. A message takes 6 bytes more
+   *   than its text
+   * @tparam NumProducers - number of rings
+   * @tparam NumFixed - rings used by index (printfFrom etc), the rest are for threads
+   */
+  template<write_type_func write_func, uint16_t BufferSize, uint8_t NumProducers = 4, uint8_t NumFixed = 0,
+           char OverrunIndicator = '~'>
+  class BG_messageMT {
+    static_assert(NumFixed <= NumProducers, "NumFixed is more than NumProducers!");
+    static constexpr uint16_t HeaderSize = 6; ///< uint32_t time, uint16_t text size
+
+    template<typename T>
+    static T Load(const T &x) {
+#if AVP_BG_MESSAGE_ATOMIC
+      return __atomic_load_n(&x, __ATOMIC_ACQUIRE);
+#else
+      return *(volatile const T *)&x;
+#endif
+    } // Load
+
+    template<typename T>
+    static void Store(T &x, T Value) {
+#if AVP_BG_MESSAGE_ATOMIC
+      __atomic_store_n(&x, Value, __ATOMIC_RELEASE);
+#else
+      *(volatile T *)&x = Value;
+#endif
+    } // Store
+
+    /// single producer, single consumer (WriteOut)
+    struct Ring {
+      uint8_t Data[BufferSize];
+      uint16_t Head, Tail; ///< free running, Head is moved by producer, Tail by WriteOut
+      bool Overrun; ///< producer dropped a message
+      bool Owned; ///< by a thread
+
+      void Put(uint16_t Pos, const void *p, uint16_t n) {
+        const uint16_t Start = Pos % BufferSize, First = BufferSize - Start;
+        if(n <= First) memcpy(Data + Start, p, n);
+        else {
+          memcpy(Data + Start, p, First);
+          memcpy(Data, (const uint8_t *)p + First, n - First);
+        }
+      } // Put
+      void Get(uint16_t Pos, void *p, uint16_t n) const {
+        const uint16_t Start = Pos % BufferSize, First = BufferSize - Start;
+        if(n <= First) memcpy(p, Data + Start, n);
+        else {
+          memcpy(p, Data + Start, First);
+          memcpy((uint8_t *)p + First, Data, n - First);
+        }
+      } // Get
+
+      bool Append(const char *Text, uint16_t Size) {
+        const uint16_t Extra = Overrun?1:0, Head_ = Head;
+        if(uint32_t(HeaderSize) + Extra + Size > uint16_t(BufferSize - uint16_t(Head_ - Load(Tail)))) {
+          Overrun = true;
+          return false;
+        }
+        const uint32_t Time = micros();
+        const uint16_t TextSize = Size + Extra;
+        Put(Head_, &Time, sizeof(Time));
+        Put(Head_ + 4, &TextSize, sizeof(TextSize));
+        const char Indicator = OverrunIndicator;
+        if(Extra) Put(Head_ + HeaderSize, &Indicator, 1);
+        Put(Head_ + HeaderSize + Extra, Text, Size);
+        Overrun = false;
+        Store(Head, uint16_t(Head_ + HeaderSize + TextSize));
+        return true;
+      } // Append
+    }; // Ring
+    static_assert((BufferSize & (BufferSize - 1)) == 0 && BufferSize <= 32768,
+                  "BufferSize should be power of 2, so uint16_t ring indexes wrap right!");
+
+    static inline Ring Rings[NumProducers];
+    static inline char Output[BufferSize];
+    static inline uint32_t NoRingDrops = 0; ///< messages of threads which got no ring
+    static constexpr uint16_t MaxText = BufferSize - HeaderSize; ///< ending 0 included, longer never fits
+
+    static bool NoRing() {
+#if AVP_BG_MESSAGE_ATOMIC
+      __atomic_fetch_add(&NoRingDrops, 1, __ATOMIC_RELAXED);
+#else
+      ++NoRingDrops;
+#endif
+      return false;
+    } // NoRing
+
+    /// ring of this thread, claimed on the first use
+    static Ring *ThreadRing() {
+      static AVP_THREAD_LOCAL struct Owner {
+        Ring *p = nullptr;
+        ~Owner() { if(p != nullptr) Store(p->Owned, false); }
+      } O;
+      if(O.p == nullptr)
+        for(uint8_t i = NumFixed; i < NumProducers; ++i) {
+#if AVP_BG_MESSAGE_ATOMIC
+          if(!__atomic_exchange_n(&Rings[i].Owned, true, __ATOMIC_ACQUIRE)) return O.p = &Rings[i];
+#else
+          if(!Rings[i].Owned) {
+            Rings[i].Owned = true;
+            return O.p = &Rings[i];
+          }
+#endif
+        }
+      return O.p;
+    } // ThreadRing
+
+    static bool vAppendTo(Ring *p, const char *format, va_list ap) {
+      if(p == nullptr) return NoRing(); // more threads than rings
+      char Text[MaxText];
+      const int Size = vsnprintf(Text, sizeof(Text), format, ap);
+      if(Size < 0) return false;
+      if(size_t(Size) >= sizeof(Text)) { // would never fit
+        p->Overrun = true;
+        return false;
+      }
+      return p->Append(Text, uint16_t(Size));
+    } // vAppendTo
+
+    template<class Fmt, typename... Args>
+    static bool FormatTo(Ring *p, const Args &... a) {
+      if(p == nullptr) return NoRing();
+      char Text[MaxText];
+      const size_t Size = formatting::Call<Fmt, Args...>(a...).Write(Text, sizeof(Text));
+      if(Size >= sizeof(Text)) { // would never fit
+        p->Overrun = true;
+        return false;
+      }
+      return p->Append(Text, uint16_t(Size));
+    } // FormatTo
+  public:
+    /// @return false if message was dropped
+    static bool vAppend(const char *format, va_list ap) { return vAppendTo(ThreadRing(), format, ap); }
+    static PRINTF_WRAPPER(bool, printf, vAppend)
+    /// printf with format parsed at compile time, see Format.hpp
+    template<class Fmt, typename... Args>
+    static bool format(Fmt, const Args &... a) { return FormatTo<Fmt>(ThreadRing(), a...); }
+
+    /// @{
+    /// from fixed ring, e.g. interrupt handler of given priority level
+    template<uint8_t Producer>
+    static bool vAppendFrom(const char *format, va_list ap) {
+      static_assert(Producer < NumFixed, "Producer is not fixed one!");
+      return vAppendTo(&Rings[Producer], format, ap);
+    } // vAppendFrom
+    template<uint8_t Producer>
+    static PRINTF_WRAPPER(bool, printfFrom, vAppendFrom<Producer>)
+    template<uint8_t Producer, class Fmt, typename... Args>
+    static bool formatFrom(Fmt, const Args &... a) {
+      static_assert(Producer < NumFixed, "Producer is not fixed one!");
+      return FormatTo<Fmt>(&Rings[Producer], a...);
+    } // formatFrom
+    /// @}
+
+    /// @return number of messages dropped because all rings were taken by other threads, NumProducers is too small
+    static uint32_t GetNoRingDrops() { return Load(NoRingDrops); }
+
+    /**
+     * should be called repeatedly from one place, e.g. main loop. Writes out messages of all rings, oldest first,
+     * as many as fit into output buffer
+     * @return false if write_func failed, messages are written next time
+     */
+    static bool WriteOut() {
+      uint16_t Tails[NumProducers], Heads[NumProducers];
+      for(uint8_t i = 0; i < NumProducers; ++i) {
+        Tails[i] = Rings[i].Tail;
+        Heads[i] = Load(Rings[i].Head);
+      }
+      uint16_t Size = 0;
+      for(;;) {
+        int Oldest = -1;
+        uint32_t OldestTime = 0;
+        uint16_t OldestSize = 0;
+        for(uint8_t i = 0; i < NumProducers; ++i) {
+          if(Tails[i] == Heads[i]) continue;
+          uint32_t Time;
+          uint16_t TextSize;
+          Rings[i].Get(Tails[i], &Time, sizeof(Time));
+          Rings[i].Get(Tails[i] + 4, &TextSize, sizeof(TextSize));
+          if(Oldest < 0 || int32_t(Time - OldestTime) < 0) {
+            Oldest = i;
+            OldestTime = Time;
+            OldestSize = TextSize;
+          }
+        }
+        if(Oldest < 0 || Size + OldestSize > BufferSize) break;
+        Rings[Oldest].Get(Tails[Oldest] + HeaderSize, Output + Size, OldestSize);
+        Size += OldestSize;
+        Tails[Oldest] += HeaderSize + OldestSize;
+      }
+      if(Size == 0) return true;
+      if(!write_func((const uint8_t *)Output, Size)) return false;
+      for(uint8_t i = 0; i < NumProducers; ++i) Store(Rings[i].Tail, Tails[i]);
+      return true;
+    } // WriteOut
+  }; // class BG_messageMT
+} // namespace avp
+
+#endif /* AVP_BGMESSAGEMT_HPP_INCLUDED */
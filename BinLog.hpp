@@ -0,0 +1,383 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief deferred binary logging: call site writes format ID, timestamp and raw arguments, text is made on the host.
+
+  Every call site gets an ID at static initialization, and its format string and argument type signature are sent
+  into the ring as definition record when the site logs the first time, so the host learns the format table from
+  the stream itself. At run time only ID (2 bytes), timestamp (4 bytes) and arguments in native binary form are
+  copied into a ring with a single block write, so a call costs tens of nanoseconds and a record is several times
+  shorter than its text.
+  @code
+    typedef avp::BinLog<10> MyLog;
+    MyLog::Log(AVP_FMT("ch %d: got %u bytes, T=%.1f\n"), Channel, Size, Temp); // from one context only, see below
+    ...
+    MyLog::call_in_loop(MyPort::write); // in main loop
+    ...
+    MyLog::Redefine(); // host reconnected and does not know formats
+  @endcode
+  Host turns received bytes back into the same text avp::format would produce:
+  @code
+    avp::binlog::Decoder D;
+    D.Feed(Data, Size);
+    for(avp::binlog::Record R; D.Next(&R);) printf("%10u %s", R.Time, R.Text.c_str());
+  @endcode
+  Format rules and argument checks are the ones of Format.hpp. Strings are copied, up to 255 bytes, pointers go as
+  numbers. Integers and floats are in target byte order, decoder expects little endian. If a record does not fit
+  into the ring it is dropped as whole and counted, the count goes out as a special record as soon as there is
+  space. The ring has single writer, so all Log calls of a BinLog should be made from one context, e.g. all from one
+  ISR or all from the main loop, and never interrupt each other. call_in_loop may run in another context.
+  */
+
+#ifndef AVP_BINLOG_HPP_INCLUDED
+#define AVP_BINLOG_HPP_INCLUDED
+
+/// @cond
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+#ifndef NO_STL
+#include <string>
+#include <vector>
+#include <map>
+#endif
+/// @endcond
+#include "Macros.h"
+#include "Format.hpp"
+#include "CircBufferWithCont.hpp"
+#include "millis_micros.hpp"
+
+namespace avp {
+  namespace binlog {
+    enum : uint16_t {
+      LOST_ID = 0xFFFF, ///< record of dropped records count, uint16_t follows timestamp
+      DEF_ID = 0xFFFE ///< definition record, ID, argument type letters, 0, format string, 0 follow timestamp
+    };
+
+    /// call site definition
+    struct Def {
+      const char *Sig; ///< argument type letters
+      const char *String; ///< format
+      uint16_t ID;
+      bool Sent; ///< definition record is in the ring
+      Def *pNext;
+    }; // Def
+
+    inline Def *pDefs = nullptr; ///< all call sites
+    inline uint16_t NumDefs = 0;
+
+    /// called at static initialization
+    inline uint16_t Register(Def *p) {
+      AVP_ASSERT_WITH_EXPL(NumDefs < DEF_ID, "Too many BinLog call sites!");
+      p->pNext = pDefs;
+      pDefs = p;
+      return p->ID = NumDefs++;
+    } // Register
+
+    constexpr size_t Length(const char *s) { return *s == 0?0:1 + Length(s + 1); }
+
+    /// @return argument type letter of table entry signature
+    template<typename A>
+    constexpr char TypeCode() {
+      typedef std::decay_t<A> D;
+      if constexpr(formatting::IsString<A>()) return 's';
+      else if constexpr(std::is_pointer_v<D> || std::is_null_pointer_v<D>) return sizeof(void *) == 8?'P':'p';
+      else if constexpr(std::is_floating_point_v<D>) return sizeof(D) == sizeof(float)?'f':'d';
+      else if constexpr(std::is_enum_v<D>) return TypeCode<std::underlying_type_t<D>>();
+      else {
+        static_assert(sizeof(D) == 1 || sizeof(D) == 2 || sizeof(D) == 4 || sizeof(D) == 8, "Unsupported integer size!");
+        const char *Codes = std::is_signed_v<D>?"bh?i???q":"BH?I???Q";
+        return Codes[sizeof(D) - 1];
+      }
+    } // TypeCode
+
+    /// @return maximum size of argument in record
+    template<typename A>
+    constexpr size_t MaxSize() {
+      switch(TypeCode<A>()) {
+        case 's': return 1 + UINT8_MAX;
+        case 'b': case 'B': return 1;
+        case 'h': case 'H': return 2;
+        case 'i': case 'I': case 'f': case 'p': return 4;
+        default: return 8;
+      }
+    } // MaxSize
+
+    template<typename T>
+    FORCE_INLINE uint8_t *Put(uint8_t *p, const T &x) {
+      memcpy(p, &x, sizeof(T));
+      return p + sizeof(T);
+    } // Put
+
+    template<typename A>
+    FORCE_INLINE uint8_t *PutArg(uint8_t *p, const A &a) {
+      typedef std::decay_t<A> D;
+      if constexpr(formatting::IsString<A>()) {
+        const char *s;
+        size_t Len;
+#ifndef NO_STL
+        if constexpr(std::is_same_v<D, std::string>) {
+          s = a.data();
+          Len = a.size();
+        } else
+#endif
+        if constexpr(std::is_array_v<A>) { // string literal, can not be null
+          s = a;
+          Len = strlen(s);
+        } else {
+          s = a == nullptr?"(null)":a;
+          Len = strlen(s);
+        }
+        if(Len > UINT8_MAX) Len = UINT8_MAX;
+        *p++ = uint8_t(Len);
+        memcpy(p, s, Len);
+        return p + Len;
+      } else if constexpr(std::is_pointer_v<D> || std::is_null_pointer_v<D>) return Put(p, uintptr_t(a));
+      else if constexpr(std::is_floating_point_v<D>) {
+        if constexpr(sizeof(D) == sizeof(float)) return Put(p, a);
+        else return Put(p, double(a));
+      } else if constexpr(std::is_same_v<D, bool>) return Put(p, uint8_t(a));
+      else return Put(p, a);
+    } // PutArg
+
+    /// call site, identified by format and argument types, Ring is there so each BinLog sends its own definitions
+    template<class Ring, class Fmt, typename... Args>
+    struct Entry {
+      static_assert(sizeof(formatting::Call<Fmt, Args...>) != 0, "Checks format and arguments");
+      static constexpr char Sig[] = {TypeCode<Args>()..., 0};
+      static constexpr size_t DefSize = 2 + 4 + 2 + sizeof(Sig) + Length(Fmt::Get()) + 1;
+      static constexpr size_t MaxRecordSize = 2 + 4 + (MaxSize<Args>() + ... + 0);
+
+      static inline Def D{Sig, Fmt::Get(), 0, false, nullptr};
+      static inline const uint16_t ID = Register(&D);
+    }; // Entry
+  } // namespace binlog
+
+  /**
+   * ring of binary log records
+   * @tparam sizeLog2 - log2 of ring size in bytes
+   * @tparam Clock - timestamp source
+   */
+  template<uint8_t sizeLog2, uint32_t (*Clock)() = micros>
+  struct BinLog {
+    static inline CircBufferWithCont<uint8_t, sizeLog2, uint32_t> Buf;
+    static inline uint16_t Lost = 0; ///< records dropped since the last LOST_ID record
+
+    /**
+     * writes record, ring gets all of it or nothing
+     * @param pDef - call site, its definition record goes first if it has not been sent yet
+     */
+    static FORCE_INLINE bool Append(const uint8_t *p, size_t Size, binlog::Def *pDef, size_t DefSize) {
+      size_t Needed = Size;
+      if(Lost != 0) Needed += 8;
+      if(!pDef->Sent) Needed += DefSize;
+      if(Buf.LeftToWrite() < Needed) {
+        if(Lost != UINT16_MAX) ++Lost;
+        return false;
+      }
+      if(Lost != 0) {
+        uint8_t Rec[8], *r = Rec;
+        r = binlog::Put(r, uint16_t(binlog::LOST_ID));
+        r = binlog::Put(r, Clock());
+        binlog::Put(r, Lost);
+        Buf.Write_(Rec, sizeof(Rec));
+        Lost = 0;
+      }
+      if(!pDef->Sent) {
+        uint8_t Rec[8], *r = Rec;
+        r = binlog::Put(r, uint16_t(binlog::DEF_ID));
+        r = binlog::Put(r, Clock());
+        binlog::Put(r, pDef->ID);
+        Buf.Write_(Rec, sizeof(Rec));
+        Buf.Write_((const uint8_t *)pDef->Sig, strlen(pDef->Sig) + 1);
+        Buf.Write_((const uint8_t *)pDef->String, strlen(pDef->String) + 1);
+        pDef->Sent = true;
+      }
+      Buf.Write_(p, Size);
+      return true;
+    } // Append
+
+    /// @return false if record was dropped because ring is full
+    template<class Fmt, typename... Args>
+    static FORCE_INLINE bool Log(Fmt, const Args &... a) {
+      typedef binlog::Entry<BinLog, Fmt, Args...> E;
+      static_assert(E::MaxRecordSize + E::DefSize + 8 < (1UL << sizeLog2), "Record may not fit into ring!");
+      uint8_t Rec[E::MaxRecordSize], *p = Rec;
+      p = binlog::Put(p, E::ID);
+      p = binlog::Put(p, Clock());
+      ((p = binlog::PutArg(p, a)), ...);
+      return Append(Rec, p - Rec, &E::D, E::DefSize);
+    } // Log
+
+    /// all definitions are sent again before their next records, e.g. when host reconnects
+    static void Redefine() {
+      for(binlog::Def *p = binlog::pDefs; p != nullptr; p = p->pNext) p->Sent = false;
+    } // Redefine
+
+    /**
+     * Should be called in loop, writes whatever is in the ring, as much as goes continuously
+     * @param write - returns false if it did not take data, they are written next time
+     */
+    static void call_in_loop(bool (*write)(const uint8_t *Ptr, size_t Size)) {
+      if(const uint32_t Size = Buf.ContinuousToRead())
+        if(write(Buf.Peek(), Size)) Buf.Skip(Size);
+    } // call_in_loop
+  }; // BinLog
+
+#ifndef NO_STL
+  namespace binlog {
+    /// decoded record
+    struct Record {
+      uint32_t Time;
+      uint16_t ID;
+      std::string Text; ///< formatted, the same as avp::format output, or note on lost records
+    }; // Record
+
+    /// host side, turns record stream back into text, learns formats from definition records
+    class Decoder {
+      struct Format {
+        std::string Sig, String;
+        std::vector<formatting::Spec> S;
+        size_t LiteralSize;
+      }; // Format
+      std::map<uint16_t, Format> Formats;
+      std::vector<uint8_t> Pending;
+      size_t Start = 0; ///< of bytes in Pending Next has not taken yet
+      size_t Unknown = 0;
+
+      /// @return argument size, 0 if arguments are incomplete
+      static size_t GetArg(char Code, const uint8_t *p, const uint8_t *End, formatting::Arg *pA) {
+        formatting::Arg &A = *pA;
+        A = formatting::Arg{};
+        const size_t Left = End - p;
+        switch(Code) {
+          case 's':
+            if(Left == 0 || Left < size_t(1) + *p) return 0;
+            A.Kind = formatting::Arg::STRING;
+            A.s = (const char *)p + 1;
+            A.Len = *p;
+            return 1 + A.Len;
+          case 'f': case 'd': {
+            A.Kind = formatting::Arg::FLOAT;
+            A.Size = Code == 'f'?sizeof(float):sizeof(double);
+            if(Left < A.Size) return 0;
+            if(Code == 'f') {
+              float f;
+              memcpy(&f, p, sizeof(f));
+              A.d = f;
+            } else memcpy(&A.d, p, sizeof(A.d));
+            return A.Size;
+          }
+          default: {
+            const char *Codes = "bBhHiIqQpP";
+            const char *pc = strchr(Codes, Code);
+            if(pc == nullptr) return 0;
+            const size_t i = pc - Codes;
+            A.Size = uint8_t(1 << (i < 8?i/2:i == 8?2:3));
+            if(Left < A.Size) return 0;
+            memcpy(&A.u, p, A.Size); // little endian
+            if(i >= 8) {
+              A.Kind = formatting::Arg::POINTER;
+              A.p = (const void *)uintptr_t(A.u);
+            } else if(i % 2 == 0) {
+              A.Kind = formatting::Arg::SIGNED;
+              if(A.Size < 8 && (A.u >> (8*A.Size - 1)) != 0) A.u |= ~uint64_t(0) << 8*A.Size; // sign extension
+            } else A.Kind = formatting::Arg::UNSIGNED;
+            return A.Size;
+          }
+        }
+      } // GetArg
+
+      /// @return size of definition record body, 0 if it is not complete, SIZE_MAX if it is broken
+      size_t Define(const uint8_t *p, const uint8_t *End) {
+        if(End - p < 2) return 0;
+        uint16_t ID;
+        memcpy(&ID, p, 2);
+        const char *Sig = (const char *)p + 2, *e = (const char *)End;
+        const char *SigEnd = (const char *)memchr(Sig, 0, e - Sig);
+        if(SigEnd == nullptr) return 0;
+        const char *StrEnd = (const char *)memchr(SigEnd + 1, 0, e - SigEnd - 1);
+        if(StrEnd == nullptr) return 0;
+        Format F;
+        F.Sig.assign(Sig, SigEnd);
+        F.String.assign(SigEnd + 1, StrEnd);
+        const size_t N = formatting::CountSpecs(F.String.c_str());
+        size_t NumArgs = 0;
+        F.LiteralSize = 0;
+        F.S.assign(N + 1, formatting::Spec{});
+        if(!formatting::ParseTo(F.String.c_str(), F.S.data(), N, &NumArgs, &F.LiteralSize) ||
+           NumArgs != F.Sig.size() || F.Sig.find_first_not_of("bBhHiIqQpPfds") != std::string::npos) return SIZE_MAX;
+        Formats[ID] = std::move(F);
+        return (const uint8_t *)StrEnd + 1 - p;
+      } // Define
+     public:
+      void Feed(const uint8_t *p, size_t Size) {
+        Pending.erase(Pending.begin(), Pending.begin() + Start); // just the tail of incomplete record, if any
+        Start = 0;
+        Pending.insert(Pending.end(), p, p + Size);
+      } // Feed
+
+      /// number of bytes skipped because of unknown ID or broken definition, decoder resynchronizes by trying
+      /// the next byte
+      size_t GetUnknown() const { return Unknown; }
+
+      /// @return false if there is no complete record yet
+      bool Next(Record *pR) {
+        size_t Pos = Start;
+        bool Got = false;
+        while(!Got && Pending.size() - Pos >= 6) {
+          const uint8_t *p = Pending.data() + Pos, *End = Pending.data() + Pending.size();
+          memcpy(&pR->ID, p, 2);
+          memcpy(&pR->Time, p + 2, 4);
+          p += 6;
+          if(pR->ID == LOST_ID) {
+            if(End - p < 2) break;
+            uint16_t n;
+            memcpy(&n, p, 2);
+            pR->Text = "<" + std::to_string(n) + " records lost>\n";
+            Pos = p + 2 - Pending.data();
+            Got = true;
+            break;
+          }
+          if(pR->ID == DEF_ID) {
+            const size_t n = Define(p, End);
+            if(n == 0) break;
+            if(n == SIZE_MAX) {
+              ++Unknown;
+              ++Pos;
+            } else Pos = p + n - Pending.data();
+            continue;
+          }
+          const auto it = Formats.find(pR->ID);
+          if(it == Formats.end()) {
+            ++Unknown;
+            ++Pos;
+            continue;
+          }
+          const Format &F = it->second;
+          std::vector<formatting::Arg> Args(F.Sig.size() + 1);
+          size_t Size = F.LiteralSize, i = 0, s = 0;
+          for(; i < F.Sig.size(); ++i) {
+            const size_t n = GetArg(F.Sig[i], p, End, &Args[i]);
+            if(n == 0) break;
+            p += n;
+            while(F.S[s].Conv == '%') ++s;
+            if(formatting::IsFloatConv(F.S[s].Conv)) formatting::ToFloat(Args[i]);
+            Size += formatting::Bound(F.S[s++], Args[i]);
+          }
+          if(i != F.Sig.size()) break; // record is not complete
+          pR->Text.assign(Size, '\0');
+          pR->Text.resize(formatting::Write(&pR->Text[0], F.String.c_str(), F.S.data(), Args.data(), Size + 1));
+          Pos = p - Pending.data();
+          Got = true;
+        }
+        Start = Pos;
+        return Got;
+      } // Next
+    }; // Decoder
+  } // namespace binlog
+#endif // NO_STL
+} // namespace avp
+
+#endif /* AVP_BINLOG_HPP_INCLUDED */
@@ -1,10 +1,64 @@
 #pragma once
 
+/// @cond
+#include <stdint.h>
+/// @endcond
 #include <../C_General/Error.h>
 
+// On hosts Append may be called concurrently from several threads (e.g. by static instances of shared libraries
+// loaded in parallel) and readers traverse chain without locks. Bare metal targets may have no compare-and-swap.
+#ifndef AVP_CHAIN_LOCK_FREE
+# if defined(__linux__) || defined(_WIN32) || defined(__APPLE__)
+#  define AVP_CHAIN_LOCK_FREE 1
+# else
+#  define AVP_CHAIN_LOCK_FREE 0
+# endif
+#endif
+
 namespace avp {
+  namespace chain {
+    /// @{
+    /// pointer access which is atomic when AVP_CHAIN_LOCK_FREE
+    template<typename P>
+    inline P Load(P const &p) {
+#if AVP_CHAIN_LOCK_FREE
+      return __atomic_load_n(&p, __ATOMIC_ACQUIRE);
+#else
+      return p;
+#endif
+    } // Load
+
+    template<typename P>
+    inline void Store(P &p, P Value) {
+#if AVP_CHAIN_LOCK_FREE
+      __atomic_store_n(&p, Value, __ATOMIC_RELEASE);
+#else
+      p = Value;
+#endif
+    } // Store
+
+    /// @return false and updates Expected if p is not equal to it
+    template<typename P>
+    inline bool CAS(P &p, P &Expected, P Value) {
+#if AVP_CHAIN_LOCK_FREE
+      return __atomic_compare_exchange_n(&p, &Expected, Value, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#else
+      if(p != Expected) {
+        Expected = p;
+        return false;
+      }
+      p = Value;
+      return true;
+#endif
+    } // CAS
+    /// @}
+  } // namespace chain
+
   /**
     This class allows to link, e.g. instances of static template classes by including into each a static field inherited from "Link"
+    Append (and Link constructor which appends) and all searches and traversals are lock-free, when AVP_CHAIN_LOCK_FREE.
+    Readers see all links appended before they started and maybe some of those being appended. Link removal
+    (destructor) and Chain destruction should not run concurrently with anything else.
   */
   struct Chain {
     /**
@@ -18,7 +72,7 @@ namespace avp {
         virtual bool IsIt(const Link *pLink) const = 0;
       }; // class Comparator
       Link(): pPrev(nullptr), pNext(nullptr) {}
-      Link(Chain *pChain) {
+      Link(Chain *pChain): pPrev(nullptr), pNext(nullptr) {
         pChain->Append(this);
       }
 
@@ -33,24 +87,78 @@ namespace avp {
 
     Chain():pEnd(&Start) {}
     virtual ~Chain() {
-      while(pEnd != &Start) delete pEnd;
+      while(pEnd != &Start) {
+        Link *p = pEnd;
+        pEnd = p->pPrev;
+        delete p;
+      }
     } // destructor
 
+    /// link is published to backward traversal by CAS on pEnd with pPrev already set, and to forward traversal
+    /// when previous link pNext is set after that
     void Append(Link *pLink) {
-      (pEnd->pNext = pLink)->pPrev = pEnd;
-      pEnd = pLink;
+      Link *pLast = chain::Load(pEnd);
+      pLink->pNext = nullptr;
+      do pLink->pPrev = pLast;
+      while(!chain::CAS(pEnd, pLast, pLink));
+      chain::Store(pLast->pNext, pLink);
     } // Append
 
+    /**
+      consistent view of the chain: links appended before snapshot was taken, later ones are not seen.
+      Traversal never blocks. If previous link of one being appended does not point to it yet, the link is found by
+      its pPrev from the end of snapshot
+      @tparam L - link type Snapshot returns
+    */
+    template<class L>
+    class Snapshot_ {
+      const Link *pFirst; //!< Chain::Start
+      const Link *pLast;
+     public:
+      explicit Snapshot_(const Chain &C): pFirst(&C.Start), pLast(chain::Load(C.pEnd)) {}
+
+      /// @return nullptr if the chain was empty
+      const L *GetFirst() const { return GetNext_(pFirst); }
+      /// @return nullptr after the last link
+      const L *GetNext(const L *p) const { return GetNext_(p); }
+
+      class Iterator {
+        const Snapshot_ &S;
+        const L *p;
+       public:
+        Iterator(const Snapshot_ &S_, const L *p_): S(S_), p(p_) {}
+        const L &operator*() const { return *p; }
+        const L *operator->() const { return p; }
+        Iterator &operator++() {
+          p = S.GetNext(p);
+          return *this;
+        } // operator++
+        bool operator!=(const Iterator &Other) const { return p != Other.p; }
+      }; // class Iterator
+
+      Iterator begin() const { return Iterator(*this, GetFirst()); }
+      Iterator end() const { return Iterator(*this, nullptr); }
+     protected:
+      const L *GetNext_(const Link *p) const {
+        if(p == pLast) return nullptr;
+        const Link *pNext = chain::Load(p->pNext);
+        if(pNext == nullptr) { // being appended, backward links are always there
+          pNext = pLast;
+          while(pNext->pPrev != p) pNext = pNext->pPrev;
+        }
+        return static_cast<const L *>(pNext);
+      } // GetNext_
+    }; // class Snapshot_
+
+    typedef Snapshot_<Link> Snapshot;
+    Snapshot GetSnapshot() const { return Snapshot(*this); }
 
    /**
     @param fComp: find first Link for which "fComp" returns true
     */
     const Link *FindFirst(const Link::Comparator &c) const {
-      const Link *pCur = Start.pNext;
-      while(pCur != nullptr) {
-        if(c.IsIt(pCur)) return pCur;
-        pCur = pCur->pNext;
-      }
+      for(const Link &l: GetSnapshot())
+        if(c.IsIt(&l)) return &l;
       return nullptr;
     } // FindFirst
 
@@ -58,7 +166,7 @@ namespace avp {
     @param fComp: find last Link for which "fComp" returns true
     */
     const Link *FindLast(const Link::Comparator &c) const {
-      const Link *pCur = pEnd;
+      const Link *pCur = chain::Load(pEnd);
       while(pCur != &Start) {
         if(c.IsIt(pCur)) return pCur;
         pCur = pCur->pPrev;
@@ -70,12 +178,34 @@ namespace avp {
    protected:
     Link Start, *pEnd; //!< Link Start is fudge Link to avoid checking for nullptr all the time
     //!< Link Start has pPrev == nullptr, that's how we detect it
+
+    /// should be called by derived chains before link which knows its chain is unlinked
+    void Removing(const Link *pLink) { if(pEnd == pLink) pEnd = pLink->pPrev; }
   }; // class Chain
 
-  template<typename key_type>
+  namespace chain {
+    /// default ChainByKey index hash, for integer, enum and pointer keys
+    struct IntHash {
+      template<typename key_type>
+      static uint32_t Get(key_type Key) { return uint32_t(uint64_t(Key) * 0x9E3779B97F4A7C15ULL >> 32); }
+    }; // IntHash
+  } // namespace chain
+
+  /**
+    @tparam IndexSize - number of buckets of intrusive hash index, power of 2, 0 - no index. With index
+      FindFirst/FindLast take O(1) and make no virtual calls, links are indexed when they are added by Append of this
+      class or by Link constructor taking this class pointer. Order of links in chain is not affected.
+    @tparam Hash - class with static uint32_t Get(key_type) function
+    */
+  template<typename key_type, uint16_t IndexSize = 0, class Hash = chain::IntHash>
   struct ChainByKey: public Chain {
+    static_assert((IndexSize & (IndexSize - 1)) == 0, "IndexSize should be power of 2!");
+
     class Link: public Chain::Link {
       key_type Key;
+      ChainByKey *pOwner = nullptr; //!< chain which index the link is in
+      Link *pNextInBucket = nullptr; //!< bucket is a stack, the latest appended link is first
+      friend struct ChainByKey;
      public:
       class Comparator: public Chain::Link::Comparator {
         key_type Key; // key
@@ -87,20 +217,75 @@ namespace avp {
       }; // class Comparator
       Link(key_type Key_): Key(Key_) {}
       Link(key_type Key_, Chain *pChain): Chain::Link(pChain), Key(Key_) {}
+      /// Key has to be set before link is indexed, so we append in the body
+      Link(key_type Key_, ChainByKey *pChain): Key(Key_) { pChain->Append(this); }
+      ~Link() {
+        if(pOwner != nullptr) pOwner->Unindex(this);
+      }
+      key_type GetKey() const { return Key; }
     }; // class LinkPointer
 
+    ChainByKey() {
+      for(Link *&p: Buckets) p = nullptr;
+    } // constructor
+
+    ~ChainByKey() { // links are deleted by Chain destructor, when index is gone already
+      for(Link *p: Buckets)
+        for(; p != nullptr; p = p->pNextInBucket) p->pOwner = nullptr;
+    } // destructor
+
+    /// bucket is lock-free stack, link is pushed on it after it is in the chain
+    void Append(Link *pLink) {
+      Chain::Append(pLink);
+      if(IndexSize != 0) {
+        Link *&Head = Buckets[Bucket(pLink->Key)];
+        Link *pHead = chain::Load(Head);
+        pLink->pOwner = this;
+        do pLink->pNextInBucket = pHead;
+        while(!chain::CAS(Head, pHead, pLink));
+      }
+    } // Append
+
+    typedef Chain::Snapshot_<Link> Snapshot;
+    Snapshot GetSnapshot() const { return Snapshot(*this); }
+
     /**
     @param fComp: find first Link for which "fComp" returns true
     */
     const Link *FindFirst(key_type Key) const {
-      return (const Link *)Chain::FindFirst(typename ChainByKey<key_type>::Link::Comparator(Key));
+      if(IndexSize != 0) {
+        const Link *pFound = nullptr;
+        for(const Link *p = chain::Load(Buckets[Bucket(Key)]); p != nullptr; p = p->pNextInBucket)
+          if(p->Key == Key) pFound = p;
+        return pFound;
+      }
+      return (const Link *)Chain::FindFirst(typename Link::Comparator(Key));
     } // FindFirst
 
     /**
     @param fComp: find last Link for which "fComp" returns true
     */
     const Link *FindLast(key_type Key) const {
-      return (const Link *)Chain::FindLast(typename ChainByKey<key_type>::Link::Comparator(Key));
+      if(IndexSize != 0) {
+        for(const Link *p = chain::Load(Buckets[Bucket(Key)]); p != nullptr; p = p->pNextInBucket)
+          if(p->Key == Key) return p;
+        return nullptr;
+      }
+      return (const Link *)Chain::FindLast(typename Link::Comparator(Key));
     } // FindLast
+
+   protected:
+    Link *Buckets[IndexSize == 0?1:IndexSize];
+
+    static uint16_t Bucket(key_type Key) { return uint16_t(Hash::Get(Key) & (IndexSize - 1)); }
+
+    void Unindex(Link *pLink) {
+      for(Link **pp = &Buckets[Bucket(pLink->Key)]; *pp != nullptr; pp = &(*pp)->pNextInBucket)
+        if(*pp == pLink) {
+          *pp = pLink->pNextInBucket;
+          break;
+        }
+      Removing(pLink);
+    } // Unindex
   }; // class ChainByKey
 } // namespace avp
@@ -1,63 +1,248 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief typed intrusive lists. Item class inherits link, so adding it to a list allocates nothing and
+  iteration gives items directly, with no pointer to content.
+  @code
+    struct Sensor: avp::TypedChain<Sensor>::Link { int Channel; ... };
+    avp::TypedChain<Sensor> Sensors;
+    Sensor S1, S2;
+    Sensors.Append(&S1); Sensors.Append(&S2);
+    for(Sensor &s: Sensors) ...
+    for(Sensor &s: Sensors.Reversed()) ...
+  @endcode
+  Item may be in several lists at once if it inherits links with different Tag classes. Lists do not own items:
+  item destructor unlinks it, list destructor unlinks all items.
+  TypedSList is singly linked variant, one pointer per item, but removal of an item from the middle is O(n).
+  Neither is thread safe.
+  */
+
 #pragma once
 
+/// @cond
+#include <stddef.h>
+/// @endcond
+#include "Error.h"
 
-#warning NOT FINISHED, USE "CHAIN" IF POSSIBLE
 namespace avp {
-  template<typename T>
-  struct Chain {
+  /**
+   * doubly linked circular list with sentinel, so there are no nullptr checks, and unlink is O(1)
+   * @tparam T - item class, should inherit TypedChain<T, Tag>::Link
+   * @tparam Tag - distinguishes links of different lists of the same item class
+   */
+  template<class T, class Tag = void>
+  class TypedChain {
+   public:
     class Link {
-      const T *pContent;
-      Link *pPrev, *pNext;
+      Link *pPrev, *pNext; //!< nullptr when item is not in a list
+      friend class TypedChain;
      public:
-      Link(const T *pContent_):pContent(pContent_), pPrev(nullptr), pNext(nullptr) {}
-      Link(const T *pContent_, Chain *pChain): pContent(pContent_) { pChain->Append(this); }
-      ~Link() {
-        if(pNext != nullptr) pNext->pPrev = pPrev;
-        if(pPrev != nullptr) pPrev->pNext = pNext;
-      }
-      friend class Chain;
-    };
-
-    Chain():pEnd(&Start) {}
-    ~Chain() {
-      while(pEnd != &Start) delete pEnd;
-    } // destructor
-
-    void Append(Link *pLink) {
-      (pEnd->pNext = pLink)->pPrev = pEnd;
-      pEnd = pLink;
-    } // Append
+      Link(): pPrev(nullptr), pNext(nullptr) {}
+      Link(const Link &): Link() {} //!< copy of an item is not in a list
+      Link &operator=(const Link &) { return *this; }
+      ~Link() { Unlink(); }
+
+      bool IsLinked() const { return pNext != nullptr; }
+
+      /// removes item from whatever list it is in, O(1)
+      void Unlink() {
+        if(pNext == nullptr) return;
+        pNext->pPrev = pPrev;
+        pPrev->pNext = pNext;
+        pPrev = pNext = nullptr;
+      } // Unlink
+    }; // class Link
+
+    template<class U, bool Forward>
+    class Iterator {
+      Link *p;
+      friend class TypedChain;
+      explicit Iterator(Link *p_): p(p_) {}
+     public:
+      U &operator*() const { return *static_cast<U *>(p); }
+      U *operator->() const { return static_cast<U *>(p); }
+      Iterator &operator++() {
+        p = Forward?p->pNext:p->pPrev;
+        return *this;
+      } // operator++
+      Iterator &operator--() {
+        p = Forward?p->pPrev:p->pNext;
+        return *this;
+      } // operator--
+      bool operator==(const Iterator &Other) const { return p == Other.p; }
+      bool operator!=(const Iterator &Other) const { return p != Other.p; }
+    }; // class Iterator
+
+    typedef Iterator<T, true> iterator;
+    typedef Iterator<const T, true> const_iterator;
+    typedef Iterator<T, false> reverse_iterator;
+    typedef Iterator<const T, false> const_reverse_iterator;
+
+    TypedChain() { Start.pPrev = Start.pNext = &Start; }
+    TypedChain(const TypedChain &) = delete;
+    TypedChain &operator=(const TypedChain &) = delete;
+    ~TypedChain() { Clear(); }
+
+    bool IsEmpty() const { return Start.pNext == &Start; }
+
+    /// @param pItem - should not be in this list already, if it is in another list it is moved from there
+    void Append(T *pItem) { InsertBefore(&Start, pItem); }
+    void Prepend(T *pItem) { InsertBefore(Start.pNext, pItem); }
+    void InsertBefore(T *pWhere, T *pItem) { InsertBefore(static_cast<Link *>(pWhere), pItem); }
+    void InsertAfter(T *pWhere, T *pItem) { InsertBefore(static_cast<Link *>(pWhere)->pNext, pItem); }
 
-    void Append(const T *pItem) { new Link(pItem, this); }
-
-    const Link *GetFirstP() {
-      return Start.pNext;
-    }
-    const Link *GetNextP(const Link *p) {
-      AVP_ASSERT(p != nullptr);
-      return p->pNext;
-    } // GetNextP
-
-    const Link *GetPrevP(const Link *p) {
-      AVP_ASSERT(p != nullptr);
-      return p->pPrev;
-    } // GetPrevP
-
-    const T *GetpItemP(const Link *p) {
-      AVP_ASSERT(p != nullptr);
-      return p->pContent;
-    } // GetpItemP
-
-    bool Contains(const T *pItem) {
-      while(pEnd != &Start) {
-        if(pEnd->pContent == pItem) return true;
-        pEnd = pEnd->pPrev;
-      }
+    static void Remove(T *pItem) { static_cast<Link *>(pItem)->Unlink(); }
+
+    /// @return removed item or nullptr if the list is empty
+    T *PopFront() {
+      if(IsEmpty()) return nullptr;
+      T *p = static_cast<T *>(Start.pNext);
+      Remove(p);
+      return p;
+    } // PopFront
+
+    T *GetFirst() const { return IsEmpty()?nullptr:static_cast<T *>(Start.pNext); }
+    T *GetLast() const { return IsEmpty()?nullptr:static_cast<T *>(Start.pPrev); }
+    /// @return nullptr at the end of the list
+    T *GetNext(const T *pItem) const { return Item(static_cast<const Link *>(pItem)->pNext); }
+    T *GetPrev(const T *pItem) const { return Item(static_cast<const Link *>(pItem)->pPrev); }
+
+    bool Contains(const T *pItem) const {
+      for(const T &Item: *this) if(&Item == pItem) return true;
       return false;
     } // Contains
+
+    void Clear() {
+      while(!IsEmpty()) Start.pNext->Unlink();
+    } // Clear
+
+    iterator begin() { return iterator(Start.pNext); }
+    iterator end() { return iterator(&Start); }
+    const_iterator begin() const { return const_iterator(Start.pNext); }
+    const_iterator end() const { return const_iterator(const_cast<Link *>(&Start)); }
+    reverse_iterator rbegin() { return reverse_iterator(Start.pPrev); }
+    reverse_iterator rend() { return reverse_iterator(&Start); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(Start.pPrev); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(const_cast<Link *>(&Start)); }
+
+    /// for range-for from the last item to the first
+    class ReversedRange {
+      TypedChain &C;
+     public:
+      explicit ReversedRange(TypedChain &C_): C(C_) {}
+      reverse_iterator begin() const { return C.rbegin(); }
+      reverse_iterator end() const { return C.rend(); }
+    }; // class ReversedRange
+    ReversedRange Reversed() { return ReversedRange(*this); }
    protected:
-    Link Start, *pEnd; //!< Link Start is fudge Link to avoid checking for nullptr all the time
-    //!< Link Start has pPrev == nullptr, that's how we detect it
-  }; // class Chain
+    Link Start; //!< sentinel, Start.pNext is the first item, Start.pPrev is the last one
 
+    T *Item(const Link *p) const { return p == &Start?nullptr:static_cast<T *>(const_cast<Link *>(p)); }
 
+    void InsertBefore(Link *pWhere, T *pItem) {
+      Link *p = static_cast<Link *>(pItem);
+      AVP_ASSERT(p != pWhere);
+      p->Unlink();
+      p->pNext = pWhere;
+      p->pPrev = pWhere->pPrev;
+      pWhere->pPrev->pNext = p;
+      pWhere->pPrev = p;
+    } // InsertBefore
+  }; // class TypedChain
+
+  /**
+   * singly linked list, link is a single pointer
+   * @tparam T - item class, should inherit TypedSList<T, Tag>::Link
+   */
+  template<class T, class Tag = void>
+  class TypedSList {
+   public:
+    class Link {
+      Link *pNext;
+      friend class TypedSList;
+     public:
+      Link(): pNext(nullptr) {}
+      Link(const Link &): Link() {}
+      Link &operator=(const Link &) { return *this; }
+      /// @note link does not know its list, so item should be removed before it is destroyed
+    }; // class Link
+
+    template<class U>
+    class Iterator {
+      Link *p;
+      friend class TypedSList;
+      explicit Iterator(Link *p_): p(p_) {}
+     public:
+      U &operator*() const { return *static_cast<U *>(p); }
+      U *operator->() const { return static_cast<U *>(p); }
+      Iterator &operator++() {
+        p = p->pNext;
+        return *this;
+      } // operator++
+      bool operator==(const Iterator &Other) const { return p == Other.p; }
+      bool operator!=(const Iterator &Other) const { return p != Other.p; }
+    }; // class Iterator
+
+    typedef Iterator<T> iterator;
+    typedef Iterator<const T> const_iterator;
+
+    TypedSList(): pFirst(nullptr), pLast(nullptr) {}
+    TypedSList(const TypedSList &) = delete;
+    TypedSList &operator=(const TypedSList &) = delete;
+
+    bool IsEmpty() const { return pFirst == nullptr; }
+
+    void PushFront(T *pItem) {
+      Link *p = static_cast<Link *>(pItem);
+      if((p->pNext = pFirst) == nullptr) pLast = p;
+      pFirst = p;
+    } // PushFront
+
+    void Append(T *pItem) {
+      Link *p = static_cast<Link *>(pItem);
+      p->pNext = nullptr;
+      if(pLast == nullptr) pFirst = p; else pLast->pNext = p;
+      pLast = p;
+    } // Append
+
+    /// @return removed item or nullptr if the list is empty
+    T *PopFront() {
+      if(pFirst == nullptr) return nullptr;
+      Link *p = pFirst;
+      if((pFirst = p->pNext) == nullptr) pLast = nullptr;
+      p->pNext = nullptr;
+      return static_cast<T *>(p);
+    } // PopFront
+
+    /// O(n)
+    /// @return false if item is not in the list
+    bool Remove(T *pItem) {
+      Link *const p = static_cast<Link *>(pItem), *pPrev = nullptr;
+      for(Link **pp = &pFirst; *pp != nullptr; pPrev = *pp, pp = &(*pp)->pNext)
+        if(*pp == p) {
+          *pp = p->pNext;
+          if(pLast == p) pLast = pPrev;
+          p->pNext = nullptr;
+          return true;
+        }
+      return false;
+    } // Remove
+
+    bool Contains(const T *pItem) const {
+      for(const T &Item: *this) if(&Item == pItem) return true;
+      return false;
+    } // Contains
+
+    T *GetFirst() const { return static_cast<T *>(pFirst); }
+    T *GetLast() const { return static_cast<T *>(pLast); }
+    /// @return nullptr at the end of the list
+    static T *GetNext(const T *pItem) { return static_cast<T *>(static_cast<const Link *>(pItem)->pNext); }
+
+    iterator begin() { return iterator(pFirst); }
+    iterator end() { return iterator(nullptr); }
+    const_iterator begin() const { return const_iterator(pFirst); }
+    const_iterator end() const { return const_iterator(nullptr); }
+   protected:
+    Link *pFirst, *pLast;
+  }; // class TypedSList
+} // namespace avp
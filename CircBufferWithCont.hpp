@@ -14,6 +14,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 /** Circular Buffer of elements of class T. One reader and one writer may work in parallel. Reader is using
   * only BeingRead index, and writer only BeingWritten, so index can be screwed-up ONLY when cross-used,
@@ -46,6 +47,17 @@ struct CircBufferWithCont {
 
   FORCE_INLINE void Write_(T const &d) { *GetSlotToWrite() = d; FinishedWriting(); }
 
+  /// writes n elements at once, reader sees all of them at the same time. There should be space, see LeftToWrite
+  FORCE_INLINE void Write_(T const *p, tSize n) {
+    const tSize First = GetCapacity() + 1 - BeingWritten; // to the end of buffer
+    if(n <= First) memcpy(&Buffer[BeingWritten], p, n*sizeof(T));
+    else {
+      memcpy(&Buffer[BeingWritten], p, First*sizeof(T));
+      memcpy(Buffer, p + First, (n - First)*sizeof(T));
+    }
+    BeingWritten = (BeingWritten + n) & Mask;
+  } // Write_
+
   FORCE_INLINE bool Write(T const &d) {
     if(LeftToWrite() == 0) return false;
     else { Write_(d); return true; }
@@ -113,6 +125,21 @@ struct CircBufferWithCont {
 
   FORCE_INLINE tSize GetSizeToRead() { return LastBlockSize; }
 
+  // ************* in place reading functions, unlike GetContinousBlockToRead they do not mark read in progress
+  /// pointer to the first element to read
+  FORCE_INLINE T const * Peek() const { return &Buffer[BeingRead]; }
+  /// number of elements which can be read continuously from Peek() pointer right now
+  FORCE_INLINE tSize ContinuousToRead() const {
+    auto FrozenBeingWritten = BeingWritten; // BeingWritten can change behind our back
+    return BeingRead > FrozenBeingWritten?GetCapacity() + 1 - BeingRead:FrozenBeingWritten - BeingRead;
+  } // ContinuousToRead
+  /// how many elements may eventually be read continuously from Peek() pointer
+  FORCE_INLINE tSize ContinuousSpace() const {
+    return BeingRead == 0?GetCapacity():GetCapacity() + 1 - BeingRead;
+  } // ContinuousSpace
+  /// finishes reading of Size elements from Peek() pointer
+  FORCE_INLINE void Skip(tSize Size) { BeingRead = (BeingRead + Size) & Mask; }
+
   // ************* service functions
   // for debugging purposes
   FORCE_INLINE void GetInternals(tSize *WriteI, tSize *ReadI, tSize *ReadSize) {
@@ -7,27 +7,38 @@
 
 /// @cond
 #include <stdint.h>
+#include <new>
 /// @endcond
 #include "BitBang.hpp"#include "MyMath.hpp"
 #include "Error.hpp"
 #include "BitBang.hpp"
 #include "CommandParser.hpp"
+#include "CommandProfile.hpp"
+
+#ifndef AVP_COMMAND_LIST_SIZE
+#define AVP_COMMAND_LIST_SIZE 0 ///< default CommandList static pool size, 0 - links are allocated on heap
+#endif
 
 namespace avp {
-/// unidirectional command chain
-  template<typename IDtype, uint8_t MaxNumParamBytes = UINT8_MAX-1-sizeof(IDtype)>
-  class CommandChain: public CommandParser {
-  public:
-    static constexpr uint8_t VAR_PARAM_NUM = UINT8_MAX; ///< NumParamBytes value which designates variable parameter number
+  /**
+   * default CommandChain dictionary: commands are added at run time into a linked list. Another dictionary
+   * is CommandHash, built at compile time, which also finds duplicate commands at compile time.
+   * Dictionary should provide static const CommandInfo *Find(IDtype ID)
+   * @tparam MaxNumCommands - number of commands registered, links are placed one after another into static pool
+   *   of this size, so registration needs no allocator. Links beyond it, and all links if it is 0, are allocated
+   *   on heap
+   */
+  template<typename IDtype, uint8_t MaxNumParamBytes, uint16_t MaxNumCommands = AVP_COMMAND_LIST_SIZE>
+  class CommandList {
   protected:
+    static constexpr uint8_t VAR_PARAM_NUM = CommandParser::VAR_PARAM_NUM;
+
     /// One Command makes a Link ------------------------------------------------
-    static struct Link {
+    static struct Link: public CommandInfo {
       union {
         const IDtype ID; ///< command ID is just its ASCII name converted to IDtype
         const char Name[sizeof(IDtype)];
       };
-      const CommandFunc_ pFunc;
-      const uint8_t NumParamBytes;
       Link *pNext;
       // public:
       /// constructor
@@ -36,28 +47,23 @@ namespace avp {
       /// @param NumParamBytes_ if VAR_PARAM_NUM the command has variable number of arguments, and the first
       ///   parameter byte is the number of following parameters
       /// @param pFirst - pointger to the first link in the chain, current Link will be inserted in front
-      Link(const char *Name_, CommandFunc_ pFunc_, uint8_t NumParamBytes_, Link *pFirst):
-        ID(Chars2type<IDtype>(Name_)), pFunc(pFunc_), NumParamBytes(NumParamBytes_), pNext(pFirst) {
+      /// @param pInPlace_, FixedBytes_ - see TypedHandler
+      Link(const char *Name_, CommandFunc_ pFunc_, uint8_t NumParamBytes_, Link *pFirst,
+           InPlaceFunc_ pInPlace_ = nullptr, uint8_t FixedBytes_ = 0):
+        CommandInfo{pFunc_, NumParamBytes_, pInPlace_, FixedBytes_}, ID(Chars2type<IDtype>(Name_)), pNext(pFirst) {
         AVP_ASSERT_WITH_EXPL((ID & 0xFF) != 0,"Byte  0 is reserved for NOOP pseudo-command.");
-        AVP_ASSERT_WITH_EXPL(NumParamBytes == VAR_PARAM_NUM ||
-                             NumParamBytes <= MaxNumParamBytes,
-                             "Modify MaxNumParamBytes to accommodate %hu bytes.",NumParamBytes);
-        AVP_ASSERT_WITH_EXPL(pFunc != nullptr,"We do not do useless commands.");
+        AVP_ASSERT_WITH_EXPL((ID & 0xFF) != CommandParser::BATCH_CODE,"Byte 0xFF is reserved for batch frames.");
+        AVP_ASSERT_WITH_EXPL(this->NumParamBytes == VAR_PARAM_NUM ||
+                             this->NumParamBytes <= MaxNumParamBytes,
+                             "Modify MaxNumParamBytes to accommodate %hu bytes.",this->NumParamBytes);
+        AVP_ASSERT_WITH_EXPL(this->pFunc != nullptr,"We do not do useless commands.");
       } //  constructor
       bool IsIt(IDtype ID_) const { return ID_ == ID; }
     } *pFirst;  ///< pointer to the first command in chain -----------------------
 
-    // check for a new command
-    static struct InputBytes_ {
-      union {
-        IDtype ID;
-        uint8_t Name[sizeof(IDtype)];
-      };
-      uint8_t Params[MaxNumParamBytes+1]; ///< one byte is left for CS,
-      /// actually checksum is in Params[pCur->NumParamBytes]
-    } InputBytes;
-
-    static uint8_t *pInputByte; ///< tracks byte number of current command packet
+    static uint16_t NumLinks;
+    /// static storage of links, they are constructed in place
+    alignas(Link) static uint8_t Pool[(MaxNumCommands + (MaxNumCommands == 0))*sizeof(Link)];
 
     /// this find function is a bit tricky - it moves found command to the start of the chain,
     /// so if the same command is called over and over we will be fincing it very fast
@@ -77,7 +83,7 @@ namespace avp {
       return nullptr;
     } // FindByID
   public:
-    static uint32_t Count; ///< purely informative variable, counts commands
+    static const CommandInfo *Find(IDtype ID) { return FindByID(ID); }
 
     /**
     @brief adds command to chain
@@ -86,57 +92,191 @@ namespace avp {
     @param Name - command mnemonics
     @param pFunc - callback function to call when command arrives
     */
-    static void AddCommand(const char Name[sizeof(IDtype)], CommandFunc_ pFunc, uint8_t NumParamBytes) {
+    static void AddCommand(const char Name[sizeof(IDtype)], CommandFunc_ pFunc, uint8_t NumParamBytes,
+                           InPlaceFunc_ pInPlace = nullptr, uint8_t FixedBytes = 0) {
       AVP_ASSERT_WITH_EXPL(FindByID(Chars2type<IDtype>(Name)) == nullptr,
                            "A command with this ID already exists."); // check whether we have this command name already
       AVP_ASSERT(NumParamBytes == VAR_PARAM_NUM || NumParamBytes <= MaxNumParamBytes);
-      pFirst = new Link(Name,pFunc,NumParamBytes,pFirst);
+      if constexpr(MaxNumCommands != 0) // Pool is not even instantiated otherwise
+        if(NumLinks < MaxNumCommands) {
+          pFirst = new(Pool + sizeof(Link)*NumLinks++) Link(Name,pFunc,NumParamBytes,pFirst,pInPlace,FixedBytes);
+          return;
+        }
+      pFirst = new Link(Name,pFunc,NumParamBytes,pFirst,pInPlace,FixedBytes);
     } // AddCommand
 
-    static void Flush() { pInputByte = (uint8_t *)InputBytes.Name; }
+    /// adds typed command, parameters are decoded according to Func signature, see TypedHandler
+    template<auto Func>
+    static void AddCommand(const char Name[sizeof(IDtype)]) {
+      typedef TypedHandler<Func> H;
+      static_assert(H::FixedBytes + H::IsVar <= MaxNumParamBytes, "Modify MaxNumParamBytes to accommodate parameters.");
+      AddCommand(Name, H::Call, H::IsVar?VAR_PARAM_NUM:H::FixedBytes, H::CallInPlace, H::FixedBytes);
+    } // AddCommand
+  }; // CommandList
+
+  template<typename IDtype, uint8_t MaxNumParamBytes, uint16_t MaxNumCommands>
+  typename CommandList<IDtype, MaxNumParamBytes, MaxNumCommands>::Link *
+  CommandList<IDtype, MaxNumParamBytes, MaxNumCommands>::pFirst = nullptr;
+  template<typename IDtype, uint8_t MaxNumParamBytes, uint16_t MaxNumCommands>
+  uint16_t CommandList<IDtype, MaxNumParamBytes, MaxNumCommands>::NumLinks = 0;
+  template<typename IDtype, uint8_t MaxNumParamBytes, uint16_t MaxNumCommands>
+  alignas(typename CommandList<IDtype, MaxNumParamBytes, MaxNumCommands>::Link)
+  uint8_t CommandList<IDtype, MaxNumParamBytes, MaxNumCommands>::Pool[(MaxNumCommands + (MaxNumCommands == 0))*sizeof(Link)];
+
+/// unidirectional command chain
+/// @tparam Dictionary - finds commands by ID, CommandList (default) or CommandHash
+/// @tparam Checksum - command checksum policy, SumChecksum (default) or Crc8Checksum
+  template<typename IDtype, uint8_t MaxNumParamBytes = UINT8_MAX-1-sizeof(IDtype),
+           class Dictionary = CommandList<IDtype, MaxNumParamBytes>, class Checksum = SumChecksum>
+  class CommandChain: public CommandParser, public Dictionary {
+  protected:
+    // check for a new command
+    static struct InputBytes_ {
+      union {
+        IDtype ID;
+        uint8_t Name[sizeof(IDtype)];
+      };
+      uint8_t Params[MaxNumParamBytes]; ///< checksum is not stored, it is checked as it arrives
+    } InputBytes;
+
+    static uint8_t *pInputByte; ///< tracks byte number of current command packet
+    static const CommandInfo *pCur; ///< command being received
+    static uint16_t ParamNum; ///< number of parameter bytes of current command, including count byte
+    static constexpr uint16_t PARAM_NUM_UNKNOWN = UINT16_MAX; ///< ParamNum value until count byte arrives
+    static typename Checksum::Type RunningCS; ///< of bytes received so far
+    static CommandBatch<Checksum> Batch;
+
+    static bool AtChecksum() {
+      return pInputByte >= InputBytes.Params && size_t(pInputByte - InputBytes.Params) == ParamNum;
+    } // AtChecksum
+
+    /// @return number of parameter bytes we know are still coming
+    static size_t ParamBytesLeft() {
+      if(pInputByte < InputBytes.Params || ParamNum == PARAM_NUM_UNKNOWN) return 0;
+      const size_t Got = pInputByte - InputBytes.Params;
+      return Got < ParamNum?ParamNum - Got:0;
+    } // ParamBytesLeft
+  public:
+    using CommandParser::VAR_PARAM_NUM;
+#ifdef AVP_COMMAND_PROFILE
+    typedef CommandProfile<IDtype> Profile;
+#endif
+
+    static uint32_t Count; ///< purely informative variable, counts commands
+
+    static void Flush() {
+      pInputByte = (uint8_t *)InputBytes.Name;
+      Batch.Flush();
+    } // Flush
 
     static ParseError_ ParseByte(uint8_t NewByte) { // this is static member function
-      static const Link *pCur;
-      static uint8_t ParamNum;
-      if(pInputByte == InputBytes.Name && NewByte == 0) {       return NOOP;
+      if(Batch.Receiving()) return Batch.ParseByte(NewByte);
+      if(pInputByte == InputBytes.Name) { // new command
+        if(NewByte == 0) return NOOP;
+        if(NewByte == BATCH_CODE) return Batch.Begin();
+        RunningCS = Checksum::Init;
+      } else if(AtChecksum()) { // got everything: command, parameters and now checksum
+        if(NewByte != RunningCS) return BAD_CHECKSUM;
+        // debug_printf("Got command %.4s\n",InputBytes.Name);
+        { AVP_COMMAND_TIMER(Profile, InputBytes.ID);
+          pCur->pFunc(InputBytes.Params); // executing command
+        }
+        pInputByte = InputBytes.Name; ///< get ready for new command
+        ++Count;
+        return NO_ERROR;
       }
 
       *(pInputByte++) = NewByte;
+      RunningCS = Checksum::Update(RunningCS, NewByte);
 
       if(pInputByte == InputBytes.Params) { // just got a new command ID
-        if((pCur = FindByID(InputBytes.ID)) == nullptr) return WRONG_ID;
-      } else {
-        if(pInputByte == InputBytes.Params + 1) { // even if there is no parameters there is a CS, so we will get here anyway
-          // Ok, now we should decide where we get N of parameter  bytes from
-          // we store variable param number as a parameter, but it is not included in number of parameter byte value, that's
-          // why we have + 1 here >
-          ParamNum = pCur->NumParamBytes == VAR_PARAM_NUM?NewByte+1:pCur->NumParamBytes;
-          if(ParamNum > MaxNumParamBytes) return WRONG_PARAM_SIZE;
-        }
-
-        if(pInputByte == InputBytes.Params + ParamNum + 1)  { // got everything: command,parameters and checksum
-          uint8_t DataCS = sum<uint8_t>(InputBytes.Name,sizeof(IDtype) + ParamNum),
-                  SentCS = InputBytes.Params[ParamNum];
-          if(DataCS == SentCS) {            // debug_printf("Got command %.4s\n",InputBytes.Name);
-            pCur->pFunc(InputBytes.Params); // executing command
-            pInputByte = InputBytes.Name; ///< get ready for new command
-            ++Count;
-          } else return BAD_CHECKSUM;
-        }
+        if((pCur = Dictionary::Find(InputBytes.ID)) == nullptr) return WRONG_ID;
+        ParamNum = pCur->NumParamBytes == VAR_PARAM_NUM?PARAM_NUM_UNKNOWN:pCur->NumParamBytes;
+        if(ParamNum != PARAM_NUM_UNKNOWN && ParamNum > MaxNumParamBytes) return WRONG_PARAM_SIZE;
+      } else if(pInputByte == InputBytes.Params + 1 && ParamNum == PARAM_NUM_UNKNOWN) {
+        // we store variable param number as a parameter, but it is not included in number of parameter byte value, that's
+        // why we have + 1 here
+        ParamNum = NewByte + 1;
+        if(ParamNum > MaxNumParamBytes) return WRONG_PARAM_SIZE;
       }
       return NO_ERROR; // everything's OK
     } // ParseByte
 
+    /// parses bytes up to the first event - NOOP, error, in-place bulk parameters or checksum byte of a command.
+    /// Parameter bytes are copied and checksummed as a block. Checksum byte is left unparsed, so command handler
+    /// never runs while the caller holds bytes in place. It should be passed to ParseByte.
+    /// @param[out] pUsed - number of bytes parsed
+    static ParseError_ ParseBlock(const uint8_t *p, size_t Size, size_t *pUsed) {
+      const uint8_t *const Start = p, *const End = p + Size;
+      ParseError_ Res = NO_ERROR;
+      while(p < End && Res == NO_ERROR && !AtChecksum() && InPlaceSizeWanted() == 0) {
+        if(size_t n = ParamBytesLeft()) {
+          if(n > size_t(End - p)) n = End - p;
+          memcpy(pInputByte, p, n);
+          RunningCS = Checksum::Update(RunningCS, p, n);
+          pInputByte += n;
+          p += n;
+        } else if(size_t n = Batch.ParseBlock(p, End - p)) p += n;
+        else Res = ParseByte(*(p++));
+      }
+      *pUsed = p - Start;
+      return Res;
+    } // ParseBlock
+
+    /// when we are done with count byte and fixed parameters of in-place command returns how many bytes
+    /// the rest of parameters and checksum take, so caller may pass them to ParseInPlace right from where they are
+    static size_t InPlaceSizeWanted() {
+      if(pInputByte <= InputBytes.Params) return 0;
+      const size_t Got = pInputByte - InputBytes.Params;
+      if(pCur->pInPlace == nullptr || Got != 1U + pCur->FixedBytes || ParamNum <= Got) return 0;
+      return ParamNum - Got + 1;
+    } // InPlaceSizeWanted
+
+    /// parses the rest of command without copying it
+    /// @param p - InPlaceSizeWanted() bytes, should stay intact until this function returns
+    static ParseError_ ParseInPlace(const uint8_t *p) {
+      const size_t Size = ParamNum - (pInputByte - InputBytes.Params); // of the rest of parameters
+      if(Checksum::Update(RunningCS, p, Size) != p[Size]) return BAD_CHECKSUM;
+      { AVP_COMMAND_TIMER(Profile, InputBytes.ID);
+        pCur->pInPlace(InputBytes.Params, p);
+      }
+      pInputByte = InputBytes.Name;
+      ++Count;
+      return NO_ERROR;
+    } // ParseInPlace
+
+    /// executes next sub-command of batch frame, handler gets parameters right from batch body
+    static ParseError_ ExecuteBatchItem() {
+      if(Batch.Left() == 0) return BATCH_END;
+      IDtype ID;
+      const uint8_t *p = Batch.Take(sizeof(ID));
+      if(p == nullptr) return Batch.Drop(WRONG_PARAM_SIZE);
+      memcpy(&ID, p, sizeof(ID));
+      const CommandInfo *pInfo = Dictionary::Find(ID);
+      if(pInfo == nullptr) return Batch.Drop(WRONG_ID);
+      const bool IsVar = pInfo->NumParamBytes == VAR_PARAM_NUM;
+      const uint8_t *Params = Batch.Take(IsVar?1:pInfo->NumParamBytes);
+      if(Params == nullptr || (IsVar && Batch.Take(Params[0]) == nullptr)) return Batch.Drop(WRONG_PARAM_SIZE);
+      { AVP_COMMAND_TIMER(Profile, ID);
+        pInfo->pFunc(Params);
+      }
+      ++Count;
+      return NO_ERROR;
+    } // ExecuteBatchItem
+
     static constexpr uint8_t GetMaxParamBytes() { return MaxNumParamBytes; }
   }; //class CommandChain
 
-#define _TEMPLATE_DECL_ template<typename IDtype, uint8_t MaxNumParamBytes>
-#define _TEMPLATE_SPEC_ CommandChain<IDtype, MaxNumParamBytes>
+#define _TEMPLATE_DECL_ template<typename IDtype, uint8_t MaxNumParamBytes, class Dictionary, class Checksum>
+#define _TEMPLATE_SPEC_ CommandChain<IDtype, MaxNumParamBytes, Dictionary, Checksum>
 
-  _TEMPLATE_DECL_ typename _TEMPLATE_SPEC_::Link *_TEMPLATE_SPEC_::pFirst = nullptr;
   _TEMPLATE_DECL_ typename _TEMPLATE_SPEC_::InputBytes_ _TEMPLATE_SPEC_::InputBytes;
   _TEMPLATE_DECL_ uint8_t *_TEMPLATE_SPEC_::pInputByte = (uint8_t *)_TEMPLATE_SPEC_::InputBytes.Name;
   _TEMPLATE_DECL_ uint32_t _TEMPLATE_SPEC_::Count = 0;
+  _TEMPLATE_DECL_ const CommandInfo *_TEMPLATE_SPEC_::pCur;
+  _TEMPLATE_DECL_ uint16_t _TEMPLATE_SPEC_::ParamNum;
+  _TEMPLATE_DECL_ typename Checksum::Type _TEMPLATE_SPEC_::RunningCS;
+  _TEMPLATE_DECL_ CommandBatch<Checksum> _TEMPLATE_SPEC_::Batch;
 
 #undef _TEMPLATE_DECL_
 #undef _TEMPLATE_SPEC_
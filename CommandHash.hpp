@@ -0,0 +1,192 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief compile-time CommandChain dictionary.
+
+  When all commands are known at compile time they may be put into a constexpr table instead of
+  CommandChain::AddCommand calls. A perfect hash over command IDs is built from it at compile time, so lookup
+  is O(1) - two hashes, two table reads and a single ID comparison, it never writes, and all tables are in
+  read-only memory.
+  @code
+    void SetGain(uint8_t Channel, float Gain);
+    void Status(const uint8_t Params[]);
+
+    constexpr avp::CommandEntry<uint16_t> Commands[] = {
+      avp::MakeCommand<uint16_t, SetGain>("SG"),
+      avp::MakeCommand<uint16_t>("ST", Status, 0),
+    };
+    typedef avp::CommandChain<uint16_t, 253, avp::CommandHash<uint16_t, Commands>> Parser;
+  @endcode
+  Hash is "hash and displace": keys are split into buckets by one hash, and every bucket gets a seed for the
+  second hash which places all bucket keys into free slots. Slot table is at least twice larger than the
+  number of commands, so seeds are found fast.
+  */
+
+#ifndef AVP_COMMANDHASH_HPP_INCLUDED
+#define AVP_COMMANDHASH_HPP_INCLUDED
+
+/// @cond
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+/// @endcond
+#include "CommandParser.hpp"
+
+namespace avp {
+  template<typename IDtype>
+  struct CommandEntry {
+    IDtype ID;
+    CommandInfo Info;
+  }; // CommandEntry
+
+  /// constexpr version of Chars2type, mnemonics to command ID
+  template<typename IDtype>
+  constexpr IDtype Name2ID(const char *Name) {
+    IDtype ID = 0;
+    for(size_t i = 0; i < sizeof(IDtype); ++i)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      ID = IDtype(IDtype(ID << 4) << 4) | uint8_t(Name[i]); // two shifts, so uint8_t IDtype does not overflow
+#else
+      ID |= IDtype(IDtype(uint8_t(Name[i])) << (8*i));
+#endif
+    return ID;
+  } // Name2ID
+
+  /// @{
+  /// CommandHash table entries, parameters are the same as in CommandChain::AddCommand
+  template<typename IDtype>
+  constexpr CommandEntry<IDtype> MakeCommand(const char *Name, CommandFunc_ pFunc, uint8_t NumParamBytes) {
+    return CommandEntry<IDtype>{Name2ID<IDtype>(Name), CommandInfo{pFunc, NumParamBytes, nullptr, 0}};
+  } // MakeCommand
+
+  /// typed command, see TypedHandler
+  template<typename IDtype, auto Func>
+  constexpr CommandEntry<IDtype> MakeCommand(const char *Name) {
+    typedef TypedHandler<Func> H;
+    return CommandEntry<IDtype>{Name2ID<IDtype>(Name),
+                                CommandInfo{H::Call, H::IsVar?CommandParser::VAR_PARAM_NUM:uint8_t(H::FixedBytes),
+                                            H::CallInPlace, uint8_t(H::FixedBytes)}};
+  } // MakeCommand
+  /// @}
+
+  namespace command_hash {
+    inline constexpr uint32_t Mix(uint32_t h) { // murmur3 finalizer
+      h ^= h >> 16;
+      h *= 0x85EBCA6BU;
+      h ^= h >> 13;
+      h *= 0xC2B2AE35U;
+      return h ^ (h >> 16);
+    } // Mix
+
+    template<typename IDtype>
+    constexpr uint32_t Fold(IDtype ID) { return uint32_t(uint64_t(ID) ^ (uint64_t(ID) >> 32)); }
+
+    /// everything which is computed at compile time
+    template<typename IDtype, const auto &Table>
+    struct Builder {
+      static constexpr size_t N = sizeof(Table)/sizeof(Table[0]);
+      static_assert(N > 0 && N < UINT16_MAX, "Wrong number of commands!");
+
+      static constexpr uint8_t Log2Size() {
+        uint8_t Log2 = 1;
+        while((size_t(1) << Log2) < 2*N) ++Log2;
+        return Log2;
+      } // Log2Size
+
+      static constexpr size_t Size = size_t(1) << Log2Size(); //!< slots
+      static constexpr size_t NumBuckets = Size < 4?1:Size/4; //!< about N/2
+      typedef std::conditional_t<(N < UINT8_MAX), uint8_t, uint16_t> tIndex;
+
+      static constexpr size_t Bucket(uint32_t x) { return (Mix(x) >> 16) & (NumBuckets - 1); }
+      static constexpr size_t Slot(uint32_t x, uint16_t Seed) { return Mix(x ^ (Seed * 0x9E3779B9U)) & (Size - 1); }
+
+      struct Tables {
+        uint16_t Seeds[NumBuckets];
+        tIndex Index[Size]; //!< command index + 1, 0 - empty slot
+        bool OK;
+      }; // Tables
+
+      static constexpr bool NoDuplicates() {
+        for(size_t i = 0; i < N; ++i)
+          for(size_t j = i + 1; j < N; ++j)
+            if(Table[i].ID == Table[j].ID) return false;
+        return true;
+      } // NoDuplicates
+
+      /// first byte of mnemonics, it is received first
+      static constexpr uint8_t FirstByte(IDtype ID) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return uint8_t(uint64_t(ID) >> (8*(sizeof(IDtype) - 1)));
+#else
+        return uint8_t(ID);
+#endif
+      } // FirstByte
+
+      static constexpr bool AllValid() {
+        for(size_t i = 0; i < N; ++i)
+          if(Table[i].Info.pFunc == nullptr || FirstByte(Table[i].ID) == 0 ||
+             FirstByte(Table[i].ID) == CommandParser::BATCH_CODE) return false;
+        return true;
+      } // AllValid
+
+      static constexpr Tables Build() {
+        Tables T{};
+        if(!NoDuplicates()) return T;
+
+        size_t Count[NumBuckets] = {}, Order[NumBuckets] = {};
+        for(size_t i = 0; i < N; ++i) ++Count[Bucket(Fold(Table[i].ID))];
+        for(size_t b = 0; b < NumBuckets; ++b) { // placing larger buckets first
+          size_t k = b;
+          for(; k > 0 && Count[Order[k - 1]] < Count[b]; --k) Order[k] = Order[k - 1];
+          Order[k] = b;
+        }
+
+        for(size_t k = 0; k < NumBuckets && Count[Order[k]] != 0; ++k) {
+          const size_t b = Order[k];
+          size_t Keys[N] = {}, Slots[N] = {}, NumKeys = 0;
+          for(size_t i = 0; i < N; ++i) if(Bucket(Fold(Table[i].ID)) == b) Keys[NumKeys++] = i;
+
+          bool Found = false;
+          for(uint32_t Seed = 0; Seed <= UINT16_MAX && !Found; ++Seed) {
+            Found = true;
+            for(size_t j = 0; j < NumKeys && Found; ++j) {
+              Slots[j] = Slot(Fold(Table[Keys[j]].ID), Seed);
+              if(T.Index[Slots[j]] != 0) Found = false;
+              for(size_t l = 0; l < j && Found; ++l) if(Slots[l] == Slots[j]) Found = false;
+            }
+            if(Found) {
+              T.Seeds[b] = Seed;
+              for(size_t j = 0; j < NumKeys; ++j) T.Index[Slots[j]] = tIndex(Keys[j] + 1);
+            }
+          }
+          if(!Found) return T;
+        }
+        T.OK = true;
+        return T;
+      } // Build
+    }; // Builder
+  } // namespace command_hash
+
+  /**
+   * CommandChain dictionary built at compile time, see file description
+   * @tparam Table - constexpr array of CommandEntry
+   */
+  template<typename IDtype, const auto &Table>
+  class CommandHash {
+    typedef command_hash::Builder<IDtype, Table> B;
+    static_assert(B::NoDuplicates(), "Two commands have the same mnemonics!");
+    static_assert(B::AllValid(), "Bytes 0 and 0xFF are reserved for NOOP and batch frames, and we do not do useless commands!");
+    static constexpr typename B::Tables T = B::Build();
+    static_assert(T.OK, "Could not build perfect hash!");
+  public:
+    static const CommandInfo *Find(IDtype ID) {
+      const uint32_t x = command_hash::Fold(ID);
+      const typename B::tIndex i = T.Index[B::Slot(x, T.Seeds[B::Bucket(x)])];
+      return i != 0 && Table[i - 1].ID == ID?&Table[i - 1].Info:nullptr;
+    } // Find
+
+    static constexpr size_t GetNumCommands() { return B::N; }
+  }; // CommandHash
+} // namespace avp
+
+#endif /* AVP_COMMANDHASH_HPP_INCLUDED */
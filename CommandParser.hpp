@@ -3,19 +3,289 @@
 
 /// @cond
 #include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include <utility>
 /// @endcond
+#include "BitBang.hpp"
+
+#ifndef AVP_COMMAND_BATCH_SIZE
+#define AVP_COMMAND_BATCH_SIZE 0 ///< maximum batch frame body size, 0 disables batch frames, it takes that much RAM
+#endif
 
 namespace avp {
   typedef void (*CommandFunc_)(const uint8_t []);
+  /// handler of variable parameter number command which gets its bulk parameter bytes in place, see TypedHandler
+  /// @param Head - count byte and fixed size parameters
+  /// @param Tail - the rest of parameters
+  typedef void (*InPlaceFunc_)(const uint8_t Head[], const uint8_t *Tail);
 
   class CommandParser {
   public:
-    enum ParseError_ {NO_ERROR = 0, NOOP, WRONG_ID, BAD_CHECKSUM, WRONG_PARAM_SIZE, NUM_ERRORS};
+    static constexpr uint8_t VAR_PARAM_NUM = UINT8_MAX; ///< NumParamBytes value which designates variable parameter number
+    static constexpr uint8_t BATCH_CODE = UINT8_MAX; ///< first byte of batch frame, can not start a command ID
+    /// BATCH - batch frame is received, its sub-commands are executed by ExecuteBatchItem calls;
+    /// BATCH_END - there are no more sub-commands in batch
+    enum ParseError_ {NO_ERROR = 0, NOOP, WRONG_ID, BAD_CHECKSUM, WRONG_PARAM_SIZE, BATCH, BATCH_END, NUM_ERRORS};
     /// @retval when NO_ERROR ParseByte send response itself (e.g. from CommandFunc )
     /// when error ParseByte does not send response
 //    static ParseError_ ParseByte(uint8_t byte) = 0;
 //    static void Flush() = 0;
+//    /// number of bytes (rest of parameters and checksum) parser is ready to take in place, 0 if it is not
+//    static size_t InPlaceSizeWanted() = 0;
+//    static ParseError_ ParseInPlace(const uint8_t *p) = 0;
+//    /// parses bytes up to the first event - NOOP, error, in-place bulk parameters or checksum byte of a command.
+//    /// Checksum byte is left unparsed, so command handler never runs while the caller holds bytes in place.
+//    /// It should be passed to ParseByte
+//    static ParseError_ ParseBlock(const uint8_t *p, size_t Size, size_t *pUsed) = 0;
+//    /// executes next sub-command of received batch frame
+//    /// @retval NO_ERROR if executed, BATCH_END if there are no more, error if sub-command is malformed - the
+//    /// rest of the batch is dropped
+//    static ParseError_ ExecuteBatchItem() = 0;
   }; // class CommandParser
+
+  /// @{
+  /// Command checksum policies. Parsers update checksum with every byte as it arrives, so checking it
+  /// when the last byte comes is O(1). Communicating program has to use the same one.
+  /// - Type - checksum type, it is a single byte on the wire now
+  /// - Init - value before the first command byte
+  /// - Update(CS, b) and Update(CS, p, Size) - add a byte or a block
+
+  /// arithmetic sum of command bytes, the default
+  struct SumChecksum {
+    typedef uint8_t Type;
+    static constexpr Type Init = 0;
+    static Type Update(Type CS, uint8_t b) { return CS + b; }
+    static Type Update(Type CS, const uint8_t *p, size_t Size) {
+      while(Size--) CS += *(p++);
+      return CS;
+    } // Update
+  }; // SumChecksum
+
+  namespace checksum {
+    struct Crc8Table { uint8_t T[256]; };
+
+    constexpr Crc8Table MakeCrc8Table(uint8_t Poly) {
+      Crc8Table Out{};
+      for(unsigned i = 0; i < 256; ++i) {
+        uint8_t c = i;
+        for(uint8_t j = 0; j < 8; ++j) c = (c & 0x80)?uint8_t(c << 1) ^ Poly:uint8_t(c << 1);
+        Out.T[i] = c;
+      }
+      return Out;
+    } // MakeCrc8Table
+  } // namespace checksum
+
+  /// CRC-8, polynomial x^8 + x^2 + x + 1 (0x07), initial value 0, no reflection. It catches swapped and
+  /// burst errors sum does not, at the cost of 256 bytes table
+  struct Crc8Checksum {
+    typedef uint8_t Type;
+    static constexpr Type Init = 0;
+    static Type Update(Type CS, uint8_t b) { return Table.T[CS ^ b]; }
+    static Type Update(Type CS, const uint8_t *p, size_t Size) {
+      while(Size--) CS = Table.T[CS ^ *(p++)];
+      return CS;
+    } // Update
+   protected:
+    static constexpr checksum::Crc8Table Table = checksum::MakeCrc8Table(0x07);
+  }; // Crc8Checksum
+  /// @}
+
+  /**
+   * Batch frame carries many sub-commands under one checksum, so small commands do not pay for framing:
+   *   - BATCH_CODE byte
+   *   - uint16_t body size, little endian
+   *   - body - sub-commands in usual format (ID, count byte if variable parameter number, parameters), but
+   *     without checksums
+   *   - checksum of all bytes above
+   *   .
+   * Parser calls Begin when BATCH_CODE comes instead of a command ID and passes following bytes to ParseByte
+   * while Receiving(). When the frame is complete and correct sub-commands are taken from the body by Take,
+   * handlers get their parameters right from there.
+   * @tparam MaxSize - maximum body size
+   */
+  template<class Checksum, uint16_t MaxSize = AVP_COMMAND_BATCH_SIZE>
+  class CommandBatch {
+    enum State_: uint8_t {IDLE, SIZE_LOW, SIZE_HIGH, BODY} State = IDLE;
+    uint16_t Size = 0; ///< of body
+    uint16_t Pos = 0; ///< bytes received while receiving, taken while executing
+    typename Checksum::Type CS;
+    uint8_t Body[MaxSize + (MaxSize == 0)];
+   public:
+    typedef CommandParser::ParseError_ ParseError_;
+
+    bool Receiving() const { return State != IDLE; }
+
+    ParseError_ Begin() {
+      if(MaxSize == 0) return CommandParser::WRONG_ID;
+      Size = Pos = 0;
+      CS = Checksum::Update(Checksum::Init, CommandParser::BATCH_CODE);
+      State = SIZE_LOW;
+      return CommandParser::NO_ERROR;
+    } // Begin
+
+    /// @retval BATCH when frame is complete and checksum is correct
+    ParseError_ ParseByte(uint8_t b) {
+      switch(State) {
+        case SIZE_LOW:
+          Size = b;
+          State = SIZE_HIGH;
+          break;
+        case SIZE_HIGH:
+          Size |= uint16_t(b) << 8;
+          if(Size > MaxSize) {
+            Flush();
+            return CommandParser::WRONG_PARAM_SIZE;
+          }
+          State = BODY;
+          break;
+        case BODY:
+          if(Pos == Size) { // checksum
+            State = IDLE;
+            Pos = 0;
+            if(CS != b) {
+              Size = 0;
+              return CommandParser::BAD_CHECKSUM;
+            }
+            return CommandParser::BATCH;
+          }
+          Body[Pos++] = b;
+          break;
+        default: return CommandParser::NO_ERROR;
+      }
+      CS = Checksum::Update(CS, b);
+      return CommandParser::NO_ERROR;
+    } // ParseByte
+
+    /// copies body bytes as a block, stops before checksum
+    /// @return number of bytes taken
+    size_t ParseBlock(const uint8_t *p, size_t n) {
+      if(State != BODY) return 0;
+      if(n > size_t(Size - Pos)) n = Size - Pos;
+      memcpy(Body + Pos, p, n);
+      CS = Checksum::Update(CS, p, n);
+      Pos += n;
+      return n;
+    } // ParseBlock
+
+    void Flush() { State = IDLE; Size = Pos = 0; }
+
+    /// drops the rest of batch because of malformed sub-command
+    ParseError_ Drop(ParseError_ Res) {
+      Flush();
+      return Res;
+    } // Drop
+
+    /// @{
+    /// executing
+    size_t Left() const { return State == IDLE?Size - Pos:0; }
+    /// @return pointer to next n body bytes, nullptr if there are not that many
+    const uint8_t *Take(size_t n) {
+      if(n > Left()) return nullptr;
+      Pos += n;
+      return Body + Pos - n;
+    } // Take
+    /// @}
+  }; // CommandBatch
+
+  /// what parser has to know about a command with mnemonics ID
+  struct CommandInfo {
+    CommandFunc_ pFunc;
+    uint8_t NumParamBytes; ///< if VAR_PARAM_NUM the command has variable number of arguments, and the first
+    ///   parameter byte is the number of following parameter bytes.
+    InPlaceFunc_ pInPlace; ///< if not nullptr the command may take its bulk parameters in place
+    uint8_t FixedBytes; ///< parameter bytes after count byte which are always copied, for pInPlace
+  }; // CommandInfo
+
+  /// last parameter of typed command handler may be of this type, it makes command to take variable number of
+  /// parameter bytes. Ptr points either into parser buffer or right into Port RX buffer, so it is valid only
+  /// until handler returns
+  struct ParamSpan {
+    const uint8_t *Ptr;
+    uint8_t Size;
+  }; // ParamSpan
+
+  /**
+   * Decodes command parameter bytes into typed handler parameters at compile-time known offsets, so handlers
+   * do not have to do it with Ptr2type. Parameters are packed in the order of handler arguments, little
+   * endian. If the last parameter is ParamSpan the command takes variable parameter number: first byte is the
+   * number of following bytes, then fixed size parameters, and all remaining bytes go to span. E.g.
+   * @code
+   *   void SetGain(uint8_t Channel, float Gain);
+   *   void Upload(uint16_t Address, ParamSpan Data);
+   *   CommandChain<uint16_t>::AddCommand<SetGain>("SG");
+   *   CommandChain<uint16_t>::AddCommand<Upload>("UP"); // span is passed right from Port RX buffer when possible
+   * @endcode
+   * @tparam Func - handler, all its parameters but ParamSpan should be trivially copyable
+   */
+  template<auto Func> struct TypedHandler;
+
+  template<typename... Args, void (*Func)(Args...)>
+  struct TypedHandler<Func> {
+   protected:
+    template<typename T> static constexpr bool IsSpan() { return std::is_same<std::decay_t<T>, ParamSpan>::value; }
+    template<typename T> static constexpr size_t WireSize() { return IsSpan<T>()?0:sizeof(std::decay_t<T>); }
+
+    static constexpr size_t NumArgs = sizeof...(Args);
+    static constexpr bool Spans[] = {false, IsSpan<Args>()...};
+    static constexpr size_t Sizes[] = {0, WireSize<Args>()...};
+
+    static constexpr size_t NumSpans() {
+      size_t n = 0;
+      for(bool s: Spans) n += s;
+      return n;
+    } // NumSpans
+
+    template<size_t I> static constexpr size_t Offset() {
+      size_t Off = 0;
+      for(size_t j = 1; j <= I; ++j) Off += Sizes[j];
+      return Off;
+    } // Offset
+
+    template<typename T>
+    static std::decay_t<T> Decode(const uint8_t *p, ParamSpan Span) {
+      if constexpr(IsSpan<T>()) return Span;
+      else {
+        typedef std::decay_t<T> T_;
+        static_assert(std::is_trivially_copyable<T_>::value, "Typed command parameters should be trivially copyable!");
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        if constexpr(std::is_arithmetic<T_>::value) return Ptr2typeRev<T_>(p);
+#endif
+        T_ x;
+        memcpy(&x, p, sizeof(x));
+        return x;
+      }
+    } // Decode
+
+    template<size_t... I>
+    static void Invoke(const uint8_t *Fixed, ParamSpan Span, std::index_sequence<I...>) {
+      (void)Fixed; (void)Span;
+      Func(Decode<Args>(Fixed + Offset<I>(), Span)...);
+    } // Invoke
+
+    /// @param Head - count byte and then fixed size parameters
+    static void InvokeVar(const uint8_t Head[], const uint8_t *Tail) {
+      if(Head[0] < FixedBytes) { // command is too short, missing parameters are zeros
+        uint8_t Padded[FixedBytes + 1] = {}; // + 1 to avoid zero size array
+        memcpy(Padded, Head + 1, Head[0]);
+        Invoke(Padded, ParamSpan{Tail, 0}, std::index_sequence_for<Args...>());
+      } else Invoke(Head + 1, ParamSpan{Tail, uint8_t(Head[0] - FixedBytes)}, std::index_sequence_for<Args...>());
+    } // InvokeVar
+   public:
+    static_assert(NumSpans() == 0 || (NumSpans() == 1 && Spans[NumArgs]), "ParamSpan may only be the last parameter!");
+    static constexpr bool IsVar = NumSpans() != 0; ///< command takes variable parameter number
+    static constexpr size_t FixedBytes = Offset<NumArgs>(); ///< bytes taken by fixed size parameters
+
+    /// CommandFunc_ which parsers call
+    static void Call(const uint8_t Params[]) {
+      if constexpr(IsVar) InvokeVar(Params, Params + 1 + FixedBytes);
+      else Invoke(Params, ParamSpan{nullptr, 0}, std::index_sequence_for<Args...>());
+    } // Call
+
+    /// InPlaceFunc_ which parsers call when they can pass the span right from RX buffer, nullptr when command
+    /// takes fixed parameter number
+    static constexpr InPlaceFunc_ CallInPlace = IsVar?InvokeVar:nullptr;
+  }; // TypedHandler
 } // namespace avp
 
 #endif /* COMMANDPARSER_H_INCLUDED */
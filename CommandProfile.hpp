@@ -0,0 +1,153 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief per-command handler profiler of CommandChain and CommandTable.
+
+  Compiled in only when AVP_COMMAND_PROFILE is defined, its value is the number of commands profiled, e.g.
+  -DAVP_COMMAND_PROFILE=32. Then parsers time every handler call and Protocol counts bytes it returns.
+  Statistics are queried by avp::Protocol::ProfileCommand handler, which should be registered by user under
+  a command ID of choice.
+  Time source is AVP_COMMAND_PROFILE_CLOCK, micros by default, may be defined e.g. as a function reading
+  cycle counter.
+  @note deferred commands (see CommandQueue.hpp) are timed while queued, not while executed by worker
+  @note on hosts the table is guarded by mutex, on bare metal Timer and Snapshot should be called from the same
+  context, parser handlers are
+  */
+
+#ifndef AVP_COMMANDPROFILE_HPP_INCLUDED
+#define AVP_COMMANDPROFILE_HPP_INCLUDED
+
+#ifdef AVP_COMMAND_PROFILE
+
+/// @cond
+#include <stdint.h>
+#include <string.h>
+/// @endcond
+#include "General.h"
+#include "Macros.h"
+#include "millis_micros.hpp"
+
+#if !defined(NO_STL) && (defined(__linux__) || defined(_WIN32) || defined(__APPLE__))
+# define AVP_COMMAND_PROFILE_THREADS 1
+/// @cond
+# include <mutex>
+/// @endcond
+#else
+# define AVP_COMMAND_PROFILE_THREADS 0
+#endif
+
+#ifndef AVP_COMMAND_PROFILE_CLOCK
+#define AVP_COMMAND_PROFILE_CLOCK micros
+#endif
+
+namespace avp {
+  namespace command_profile {
+    /// Protocol adds bytes written by return functions here
+    inline AVP_THREAD_LOCAL uint32_t ReturnedBytes = 0;
+  } // namespace command_profile
+
+  /**
+   * static table of per-command statistics, commands are placed by ID hash, linear probing
+   * @tparam IDtype - command ID type of parser
+   * @tparam Size - maximum number of different commands profiled, further ones are ignored
+   */
+  template<typename IDtype, uint16_t Size = AVP_COMMAND_PROFILE>
+  class CommandProfile {
+   public:
+    /// it goes over the wire as is, in native byte order like everything else Protocol returns
+    struct Entry {
+      uint32_t Count; ///< number of calls, 0 - entry is not used
+      uint32_t TotalTime; ///< in AVP_COMMAND_PROFILE_CLOCK units
+      uint32_t MaxTime;
+      uint32_t Bytes; ///< returned by handler, including Protocol block framing
+      IDtype ID;
+    }; // Entry
+   protected:
+    static Entry Entries[Size];
+    static Entry Copy[Size]; ///< Snapshot, it is sent unbuffered while Entries keep changing
+    static volatile bool CopyBusy;
+#if AVP_COMMAND_PROFILE_THREADS
+    static inline std::mutex Lock;
+#endif
+
+    static Entry *Find(IDtype ID) {
+      uint16_t i = uint16_t(uint64_t(ID) * 0x9E3779B1U >> 16) % Size;
+      for(uint16_t n = 0; n < Size; ++n, i = i + 1 == Size?0:i + 1) {
+        if(Entries[i].Count == 0) {
+          Entries[i].ID = ID;
+          return &Entries[i];
+        }
+        if(Entries[i].ID == ID) return &Entries[i];
+      }
+      return nullptr; // table is full
+    } // Find
+   public:
+    /// times handler call from construction to destruction
+    class Timer {
+      const IDtype ID;
+      const uint32_t Start, StartBytes;
+     public:
+      explicit Timer(IDtype ID_): ID(ID_), Start(AVP_COMMAND_PROFILE_CLOCK()),
+        StartBytes(command_profile::ReturnedBytes) {}
+      ~Timer() {
+        const uint32_t Time = AVP_COMMAND_PROFILE_CLOCK() - Start;
+#if AVP_COMMAND_PROFILE_THREADS
+        std::lock_guard<std::mutex> L(Lock);
+#endif
+        if(Entry *p = Find(ID)) {
+          ++p->Count;
+          p->TotalTime += Time;
+          if(Time > p->MaxTime) p->MaxTime = Time;
+          p->Bytes += command_profile::ReturnedBytes - StartBytes;
+        }
+      } // ~Timer
+    }; // Timer
+
+    static const Entry *GetEntries() { return Entries; }
+    static constexpr size_t GetSize() { return Size; }
+    static void Reset() {
+#if AVP_COMMAND_PROFILE_THREADS
+      std::lock_guard<std::mutex> L(Lock);
+#endif
+      memset(Entries, 0, sizeof(Entries));
+    } // Reset
+
+    /**
+     * copies table, so it may be sent while handlers go on updating it
+     * @param ResetAfter - clear table after copying
+     * @return copy of GetSize() entries, or nullptr if previous copy is not Released yet
+     */
+    static const Entry *Snapshot(bool ResetAfter) {
+      if(CopyBusy) return nullptr;
+      {
+#if AVP_COMMAND_PROFILE_THREADS
+        std::lock_guard<std::mutex> L(Lock);
+#endif
+        memcpy(Copy, Entries, sizeof(Entries));
+        if(ResetAfter) memset(Entries, 0, sizeof(Entries));
+      }
+      CopyBusy = true;
+      return Copy;
+    } // Snapshot
+    /// Snapshot copy is not used any more, it is Port::tReleaseFunc
+    static void Release() { CopyBusy = false; }
+  }; // CommandProfile
+
+  template<typename IDtype, uint16_t Size>
+  typename CommandProfile<IDtype, Size>::Entry CommandProfile<IDtype, Size>::Entries[Size];
+  template<typename IDtype, uint16_t Size>
+  typename CommandProfile<IDtype, Size>::Entry CommandProfile<IDtype, Size>::Copy[Size];
+  template<typename IDtype, uint16_t Size>
+  volatile bool CommandProfile<IDtype, Size>::CopyBusy = false;
+} // namespace avp
+
+/// times handler call in the rest of the scope
+# define AVP_COMMAND_TIMER(Profile, ID) typename Profile::Timer CommandTimer_(ID)
+/// counts bytes returned by handler
+# define AVP_COMMAND_RETURNED(Size) (avp::command_profile::ReturnedBytes += (Size))
+#else
+# define AVP_COMMAND_TIMER(Profile, ID)
+# define AVP_COMMAND_RETURNED(Size)
+#endif // AVP_COMMAND_PROFILE
+
+#endif /* AVP_COMMANDPROFILE_HPP_INCLUDED */
@@ -0,0 +1,153 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief queue of deferred command handlers of avp::Protocol.
+
+  A handler which takes long (flash write, long computation) blocks Protocol::cycle, so no RX processing,
+  beacons and other periodic tasks happen until it returns. Such command may be registered deferred:
+  @code
+    typedef avp::Protocol<MyPort, MyParser, 1000, nullptr, nullptr, avp::CommandQueue<2, 16, 64>> Pr;
+    MyParser::AddCommand("FW", Pr::Deferred<FlashWrite, 6>, 6);
+  @endcode
+  Parser then just copies parameters into the queue and a worker executes handler later by calling
+  Protocol::RunDeferred - from a thread on a host, from a low priority loop slot on MCU. Handler returns are
+  captured into its queue slot and Protocol::cycle sends them out. Commands which come while deferred ones are
+  queued are executed right away, but their returns get into queue slots as well, so all returns leave in
+  command order. When queue is full Protocol stops parsing, received bytes wait in Port RX buffer.
+  */
+
+#ifndef AVP_COMMANDQUEUE_HPP_INCLUDED
+#define AVP_COMMANDQUEUE_HPP_INCLUDED
+
+/// @cond
+#include <stdint.h>
+#include <string.h>
+/// @endcond
+#include "CommandParser.hpp"
+
+namespace avp {
+  /// Protocol return functions write into it instead of Port when it is set, it gets exactly the bytes Port would
+  struct ReturnCapture {
+    uint8_t *Data;
+    uint16_t Capacity;
+    uint16_t Size;
+    bool Overflow; ///< something did not fit, captured bytes are not a valid stream
+
+    void Init(uint8_t *Data_, uint16_t Capacity_) {
+      Data = Data_;
+      Capacity = Capacity_;
+      Size = 0;
+      Overflow = false;
+    } // Init
+
+    /// @return always true, so return functions go on, overflow is reported by Overflow
+    bool Append(const uint8_t *p, size_t n) {
+      if(Overflow || Size + n > Capacity) Overflow = true;
+      else {
+        memcpy(Data + Size, p, n);
+        Size += n;
+      }
+      return true;
+    } // Append
+  }; // ReturnCapture
+
+  /// Protocol default, nothing is deferred
+  struct NoCommandQueue {
+    static constexpr bool Enabled = false;
+  }; // NoCommandQueue
+
+  /**
+   * single producer (Protocol::cycle), single consumer (worker) ring of deferred commands. Slot goes through
+   * Queued (parameters are copied or returns of a command executed right away are captured), Done (worker
+   * executed it) and Sent (returns went to Port, slot is free)
+   * @tparam Log2Size - log2 of number of slots
+   * @tparam MaxParamBytes - parameter bytes of a deferred command, including count byte
+   * @tparam ReturnSize - bytes handler may return, including Protocol block framing
+   */
+  template<uint8_t Log2Size = 2, uint8_t MaxParamBytes = 32, uint16_t ReturnSize = 64>
+  class CommandQueue {
+   public:
+    static constexpr bool Enabled = true;
+    static constexpr uint8_t Size = 1U << Log2Size;
+    static_assert(Log2Size < 8, "Counters are uint8_t!");
+
+    struct Slot {
+      CommandFunc_ Func; ///< nullptr if there is nothing to execute
+      uint8_t Params[MaxParamBytes];
+      ReturnCapture Capture;
+      uint16_t SentSize; ///< of captured returns, they go out in chunks if TX buffer is smaller
+      uint8_t Return[ReturnSize];
+    }; // Slot
+   protected:
+    static Slot Slots[Size];
+    static volatile uint8_t Queued, Done, Sent; ///< free running counters
+    static Slot *pReserved; ///< slot Protocol::cycle fills, not queued yet
+
+    static Slot &At(uint8_t i) { return Slots[i & (Size - 1)]; }
+   public:
+    static constexpr uint8_t GetMaxParamBytes() { return MaxParamBytes; }
+
+    /// there are commands whose returns are not sent yet
+    static bool Busy() { return Queued != Sent; }
+
+    /// @{
+    /// producer side
+    /// @return slot to fill or nullptr if queue is full
+    static Slot *Reserve() {
+      if(pReserved == nullptr && uint8_t(Queued - Sent) < Size) {
+        pReserved = &At(Queued);
+        pReserved->Func = nullptr;
+        pReserved->Capture.Init(pReserved->Return, ReturnSize);
+        pReserved->SentSize = 0;
+      }
+      return pReserved;
+    } // Reserve
+    static Slot *GetReserved() { return pReserved; }
+
+    /// queues reserved slot if it got command to execute or captured returns, frees it otherwise
+    static void Commit() {
+      if(pReserved == nullptr) return;
+      if(pReserved->Func != nullptr || pReserved->Capture.Size != 0 || pReserved->Capture.Overflow) {
+        __sync_synchronize(); // slot contents before counter
+        Queued = Queued + 1;
+      }
+      pReserved = nullptr;
+    } // Commit
+
+    /// @return executed slot which returns should be sent, nullptr if there is none
+    static Slot *ToSend() { return Sent != Done?&At(Sent):nullptr; }
+    static void Release() {
+      __sync_synchronize();
+      Sent = Sent + 1;
+    } // Release
+    /// @}
+
+    /// @{
+    /// consumer side
+    /// @return slot to execute, nullptr if there is none
+    static Slot *ToExecute() {
+      if(Done == Queued) return nullptr;
+      __sync_synchronize(); // counter before slot contents
+      return &At(Done);
+    } // ToExecute
+    static void Executed() {
+      __sync_synchronize();
+      Done = Done + 1;
+    } // Executed
+    /// @}
+  }; // CommandQueue
+
+#define _TEMPLATE_DECL_ template<uint8_t Log2Size, uint8_t MaxParamBytes, uint16_t ReturnSize>
+#define _TEMPLATE_SPEC_ CommandQueue<Log2Size, MaxParamBytes, ReturnSize>
+
+  _TEMPLATE_DECL_ typename _TEMPLATE_SPEC_::Slot _TEMPLATE_SPEC_::Slots[_TEMPLATE_SPEC_::Size];
+  _TEMPLATE_DECL_ volatile uint8_t _TEMPLATE_SPEC_::Queued = 0;
+  _TEMPLATE_DECL_ volatile uint8_t _TEMPLATE_SPEC_::Done = 0;
+  _TEMPLATE_DECL_ volatile uint8_t _TEMPLATE_SPEC_::Sent = 0;
+  _TEMPLATE_DECL_ typename _TEMPLATE_SPEC_::Slot *_TEMPLATE_SPEC_::pReserved = nullptr;
+
+#undef _TEMPLATE_DECL_
+#undef _TEMPLATE_SPEC_
+} // namespace avp
+
+#endif /* AVP_COMMANDQUEUE_HPP_INCLUDED */
@@ -3,6 +3,8 @@
  *  To use define
  * template<> const avp::Command_ avp::CommandTable<>::Table[] = {{command,num parameter bytes},...};
  * template<> const uint8_t CommandTable<>::NumCommands = N_ELEMENTS(Table);
+ * Typed handlers (see TypedHandler) go into the table as avp::TypedCommand<Func>()
+ * COMMAND BYTE 0xFF starts batch frame (see CommandBatch), so table may have at most 254 commands
  */
 #ifndef COMMANDTABLE_H_INCLUDED
 #define COMMANDTABLE_H_INCLUDED
@@ -10,69 +12,156 @@
 #include "Error.hpp"
 #include "MyMath.hpp"
 #include "CommandParser.hpp"
+#include "CommandProfile.hpp"
 
 namespace avp {
   struct Command_ {
     CommandFunc_ Func;
     int8_t NumParamBytes; ///< if == -1 the command has variable number of arguments, and the first
     /// parameter byte is the number of following parameters
+    InPlaceFunc_ InPlaceFunc; ///< if not nullptr the command may take its bulk parameters in place
+    uint8_t FixedBytes; ///< parameter bytes after count byte which are always copied, for InPlaceFunc
   }; // struct Command_
 
+  /// table entry for typed handler
+  template<auto Func>
+  constexpr Command_ TypedCommand() {
+    typedef TypedHandler<Func> H;
+    static_assert(H::FixedBytes <= INT8_MAX, "Too many parameter bytes for CommandTable!");
+    return Command_{H::Call, H::IsVar?int8_t(-1):int8_t(H::FixedBytes), H::CallInPlace, uint8_t(H::FixedBytes)};
+  } // TypedCommand
+
 /// Table and NumCommands should be implemented in the user code
-template<uint8_t MaxNumParamBytes = 255>
+/// @tparam Checksum - command checksum policy, SumChecksum (default) or Crc8Checksum
+template<uint8_t MaxNumParamBytes = 255, class Checksum = SumChecksum>
   class CommandTable: public CommandParser {
     protected:
-      static int8_t CurNumOfParamBytes;
-      static uint8_t InputI;
+      static int16_t CurNumOfParamBytes; ///< including count byte, -1 until count byte arrives
+      static uint16_t InputI; ///< number of command bytes received, checksum is not stored
+      static typename Checksum::Type RunningCS; ///< of bytes received so far
+      static CommandBatch<Checksum> Batch;
       static const Command_ Table[];
       static const uint8_t NumCommands;
+      static union Input_ {
+        struct {
+          uint8_t ID;
+          uint8_t Params[MaxNumParamBytes];
+        } Cmd;
+        uint8_t Bytes[MaxNumParamBytes + 1]; // command byte + param bytes
+      } Input;
+
+      static bool AtChecksum() { return InputI != 0 && CurNumOfParamBytes != -1 && InputI == CurNumOfParamBytes + 1; }
+
+      /// @return number of parameter bytes we know are still coming
+      static size_t ParamBytesLeft() {
+        return InputI != 0 && CurNumOfParamBytes != -1 && InputI <= CurNumOfParamBytes?CurNumOfParamBytes + 1 - InputI:0;
+      } // ParamBytesLeft
     public:
+      static uint32_t Count; ///< purely informative variable, counts commands
+#ifdef AVP_COMMAND_PROFILE
+      typedef CommandProfile<uint8_t> Profile;
+#endif
+
       static ParseError_ ParseByte(uint8_t b) {
-        static union Input_ {
-          struct {
-            uint8_t ID;
-            uint8_t Params[MaxNumParamBytes];
-          } Cmd;
-          uint8_t Bytes[]; // command byte + param bytes
-        } Input;
         /// @note COMMAND BYTE is index in CommandTable + 1.
         /// COMMAND BYTE == 0 is NOOP command
-        IGNORE_WARNING(-Warray-bounds)
-        Input.Bytes[InputI++] = b;
-
-        if(InputI == 1) { // b is a CurCommand.ID
-          if(b != 0) { // it is not a NOOP command
-            if(b > NumCommands || Table[b-1].Func == nullptr ) return WRONG_ID;
-            CurNumOfParamBytes = Table[b-1].NumParamBytes; // may be -1
-          } else { // 0 is NOOP command, no parameters or checksum
-            InputI = 0;
-            return NOOP;
-          }
-        } else {
-          if(InputI == 2) {
-			  if(CurNumOfParamBytes == -1) CurNumOfParamBytes = b+1; // variable number of parameters
-			  AVP_ASSERT(CurNumOfParamBytes <= MaxNumParamBytes);
-		  }
-          if(InputI == CurNumOfParamBytes + 2) { // we've got all parameter bytes
-            // and a checksum
-            if(sum<uint8_t>(Input.Bytes,InputI - 1) != b) return BAD_CHECKSUM;
-            else {
-              Table[Input.Cmd.ID-1].Func(Input.Cmd.Params); // callback function should do return itself
-              InputI = 0;
-            }
+        if(Batch.Receiving()) return Batch.ParseByte(b);
+        if(InputI == 0) { // b is a CurCommand.ID
+          if(b == 0) return NOOP; // 0 is NOOP command, no parameters or checksum
+          if(b == BATCH_CODE) return Batch.Begin();
+          if(b > NumCommands || Table[b-1].Func == nullptr ) return WRONG_ID;
+          CurNumOfParamBytes = Table[b-1].NumParamBytes; // may be -1
+          if(CurNumOfParamBytes > MaxNumParamBytes) return WRONG_PARAM_SIZE;
+          RunningCS = Checksum::Init;
+        } else if(AtChecksum()) { // we've got all parameter bytes and now a checksum
+          if(RunningCS != b) return BAD_CHECKSUM;
+          { AVP_COMMAND_TIMER(Profile, Input.Cmd.ID);
+            Table[Input.Cmd.ID-1].Func(Input.Cmd.Params); // callback function should do return itself
           }
+          InputI = 0;
+          ++Count;
+          return NO_ERROR;
+        } else if(InputI == 1 && CurNumOfParamBytes == -1) { // variable number of parameters
+          CurNumOfParamBytes = b+1; // count byte is stored as a parameter
+          if(CurNumOfParamBytes > MaxNumParamBytes) return WRONG_PARAM_SIZE;
         }
+        Input.Bytes[InputI++] = b;
+        RunningCS = Checksum::Update(RunningCS, b);
         return NO_ERROR;
       } // ParseByte
 
-      static void Flush() {InputI = 0;}
+      /// parses bytes up to the first event - NOOP, error, in-place bulk parameters or checksum byte of a command.
+      /// Parameter bytes are copied and checksummed as a block. Checksum byte is left unparsed, so command handler
+      /// never runs while the caller holds bytes in place. It should be passed to ParseByte.
+      /// @param[out] pUsed - number of bytes parsed
+      static ParseError_ ParseBlock(const uint8_t *p, size_t Size, size_t *pUsed) {
+        const uint8_t *const Start = p, *const End = p + Size;
+        ParseError_ Res = NO_ERROR;
+        while(p < End && Res == NO_ERROR && !AtChecksum() && InPlaceSizeWanted() == 0) {
+          if(size_t n = ParamBytesLeft()) {
+            if(n > size_t(End - p)) n = End - p;
+            memcpy(Input.Bytes + InputI, p, n);
+            RunningCS = Checksum::Update(RunningCS, p, n);
+            InputI += n;
+            p += n;
+          } else if(size_t n = Batch.ParseBlock(p, End - p)) p += n;
+          else Res = ParseByte(*(p++));
+        }
+        *pUsed = p - Start;
+        return Res;
+      } // ParseBlock
+
+      static void Flush() {InputI = 0; Batch.Flush();}
+
+      /// executes next sub-command of batch frame, handler gets parameters right from batch body
+      static ParseError_ ExecuteBatchItem() {
+        if(Batch.Left() == 0) return BATCH_END;
+        const uint8_t ID = *Batch.Take(1);
+        if(ID == 0 || ID > NumCommands || Table[ID-1].Func == nullptr) return Batch.Drop(WRONG_ID);
+        const bool IsVar = Table[ID-1].NumParamBytes == -1;
+        const uint8_t *Params = Batch.Take(IsVar?1:Table[ID-1].NumParamBytes);
+        if(Params == nullptr || (IsVar && Batch.Take(Params[0]) == nullptr)) return Batch.Drop(WRONG_PARAM_SIZE);
+        { AVP_COMMAND_TIMER(Profile, ID);
+          Table[ID-1].Func(Params);
+        }
+        ++Count;
+        return NO_ERROR;
+      } // ExecuteBatchItem
+
+      /// when we are done with count byte and fixed parameters of in-place command returns how many bytes
+      /// the rest of parameters and checksum take, so caller may pass them to ParseInPlace right from where they are
+      static size_t InPlaceSizeWanted() {
+        if(InputI < 2) return 0;
+        const Command_ &Cur = Table[Input.Cmd.ID-1];
+        if(Cur.InPlaceFunc == nullptr || Cur.NumParamBytes != -1 || InputI - 1 != 1 + Cur.FixedBytes ||
+           CurNumOfParamBytes <= InputI - 1) return 0;
+        return CurNumOfParamBytes - (InputI - 1) + 1;
+      } // InPlaceSizeWanted
+
+      /// parses the rest of command without copying it
+      /// @param p - InPlaceSizeWanted() bytes, should stay intact until this function returns
+      static ParseError_ ParseInPlace(const uint8_t *p) {
+        const size_t Size = CurNumOfParamBytes - (InputI - 1); // of the rest of parameters
+        if(Checksum::Update(RunningCS, p, Size) != p[Size]) return BAD_CHECKSUM;
+        { AVP_COMMAND_TIMER(Profile, Input.Cmd.ID);
+          Table[Input.Cmd.ID-1].InPlaceFunc(Input.Cmd.Params, p);
+        }
+        InputI = 0;
+        ++Count;
+        return NO_ERROR;
+      } // ParseInPlace
   }; // class CommandTable
 
-  template<uint8_t MaxNumParamBytes> int8_t CommandTable<MaxNumParamBytes>::CurNumOfParamBytes;
-  template<uint8_t MaxNumParamBytes> uint8_t CommandTable<MaxNumParamBytes>::InputI = 0;
+  template<uint8_t MaxNumParamBytes, class Checksum> int16_t CommandTable<MaxNumParamBytes, Checksum>::CurNumOfParamBytes;
+  template<uint8_t MaxNumParamBytes, class Checksum> uint16_t CommandTable<MaxNumParamBytes, Checksum>::InputI = 0;
+  template<uint8_t MaxNumParamBytes, class Checksum>
+  typename Checksum::Type CommandTable<MaxNumParamBytes, Checksum>::RunningCS;
+  template<uint8_t MaxNumParamBytes, class Checksum> uint32_t CommandTable<MaxNumParamBytes, Checksum>::Count = 0;
+  template<uint8_t MaxNumParamBytes, class Checksum>
+  CommandBatch<Checksum> CommandTable<MaxNumParamBytes, Checksum>::Batch;
+  template<uint8_t MaxNumParamBytes, class Checksum>
+  typename CommandTable<MaxNumParamBytes, Checksum>::Input_ CommandTable<MaxNumParamBytes, Checksum>::Input;
 } // namespace avp
 
-STOP_IGNORING_WARNING
-
 #endif /* COMMANDTABLE_H_INCLUDED */
 
@@ -52,6 +52,11 @@
   int debug_printf(const char *format, ...);
   void hang_cpu();     //  __attribute__((noreturn));
   void debug_action(); // if we want to debug something in General lib in primitive way
+#ifdef AVP_DEBUG_ASYNC
+  /// debug_async.cpp, output goes to file descriptor from background thread
+  void debug_async_set_fd(int fd);
+  void debug_async_flush(void); ///< returns when everything this thread output is written
+#endif
 
   typedef void (*free_func_t)(void *);
 
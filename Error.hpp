@@ -12,6 +12,7 @@
 #include "Error.h"
 #include "BitBang.hpp"
 #include "MyMath.hpp"
+#include "NumConv.hpp"
 
 #ifndef AVP_RAM_ATTR
 #define AVP_RAM_ATTR // set to IRAM_ATTR for ESP
@@ -25,49 +26,37 @@
 #endif
 
 
+/// @param LeadingZeroes - print all sizeof(T)*8 digits
 template<typename T>
 int inline AVP_RAM_ATTR debug_put_binary(T x, bool LeadingZeroes = true) {
-  for(unsigned i = 0; i < sizeof(T)*8; ++i) { 
-    if((x = avp::rotate_left(x)) & 1) {
-      if(debug_putchar('1') == -1) return -1;
-      LeadingZeroes = true;
-    } else if(LeadingZeroes) if(debug_putchar('0') == -1) return -1;
-  }
-  return 0;
+  char B[avp::num_conv::MAX_BIN + 1];
+  *avp::num_conv::UintToBin(uint64_t(std::make_unsigned_t<T>(x)), B, LeadingZeroes?sizeof(T)*8:1) = 0;
+  return debug_puts(B) == -1?-1:0;
 } // debug_put_binary<>
 
 template<typename T>
 int inline AVP_RAM_ATTR debug_put_hex(T x, bool LeadingZeroes = true) {
-  static const char Chars[] = "0123456789ABCDEF";
-
-  for(unsigned i = 0; i < sizeof(T)*2; ++i) {
-    auto v = (x = avp::rotate_left(x,4)) & 0xF; 
-    if(v) {
-      if(debug_putchar(Chars[v]) == -1) return -1;
-      LeadingZeroes = true;
-    } else if(LeadingZeroes) if(debug_putchar('0') == -1) return -1;
-  }
-  return 0;
+  char B[avp::num_conv::MAX_HEX + 1];
+  *avp::num_conv::UintToHex(uint64_t(std::make_unsigned_t<T>(x)), B, true, LeadingZeroes?sizeof(T)*2:1) = 0;
+  return debug_puts(B) == -1?-1:0;
 } // debug_put_hex<>
 
 template<typename T>
 int inline AVP_RAM_ATTR debug_put_decimal(T x) {
-  if(x < 0) {
-    debug_putchar('-');
-    return debug_put_decimal<T>(-x);
-  }
-  char B[avp::CeilRatio(sizeof(x)*8,3U)];
-
-  uint_fast8_t i = 0;
-  do {
-    T x1 = x; x /= 10; B[i++] = '0' + x1 - x*10;
-  } while(x);
-  do {
-    if(debug_putchar(B[i-1]) == -1) return -1; 
-  } while(--i);
-  return 1; 
+  char B[avp::num_conv::MAX_INT_DEC + 1];
+  if constexpr(std::is_signed_v<T>) *avp::num_conv::IntToDec(int64_t(x), B) = 0;
+  else *avp::num_conv::UintToDec(uint64_t(x), B) = 0;
+  return debug_puts(B) == -1?-1:1;
 } // debug_put_decimal
 
+/// prints text which reads back to x, almost always the shortest one
+template<typename T>
+int inline debug_put_float(T x) {
+  char B[avp::num_conv::MAX_SHORTEST + 1];
+  *avp::num_conv::FloatToShortest(x, B) = 0;
+  return debug_puts(B) == -1?-1:1;
+} // debug_put_float
+
 #undef DEBUG_PUT_PLACE // comes from Error.h
 #define DEBUG_PUT_PLACE do { \
   debug_puts(__PRETTY_FUNCTION__); \
@@ -0,0 +1,471 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief type-safe printf-style formatting with format string parsed at compile time.
+
+  Format string is wrapped into AVP_FMT, so it becomes a type and gets parsed by the compiler: number and types of
+  arguments are checked by static_assert, literal segments and conversion specs are in a constexpr table. At run time
+  output size bound is computed from the arguments without formatting, and everything is formatted in one pass into
+  a stack buffer of AVP_FORMAT_BUFFER_SIZE bytes which goes to the sink with a single write, so output is atomic like
+  the rest of IO.hpp. Longer output goes through std::string on hosts and is truncated on bare metal.
+  @code
+    avp::format<MyPort::write>(AVP_FMT("T=%5.1f ch %d %s\n"), Temp, Channel, Name);
+    Pr::info_format(AVP_FMT("Got %u bytes\n"), Size);
+    avp::debug_format(AVP_FMT("x=%#x\n"), x);
+  @endcode
+  Conversions are d i u o x X b c s p f F e E g G and %%, with flags "-+ 0#", width and precision, '*' is not
+  supported. Extra conversion r prints text which reads back to the same float or double, almost always the shortest
+  one. Integers and r are converted by NumConv.hpp, f e g still go through snprintf to keep printf rounding. Length
+  modifiers (h l ll z j t L) are accepted and ignored, argument type is known anyway. Integer arguments are printed
+  according to their own type, e.g. unsigned value with %d never becomes negative, negative int8_t with %x gives two
+  digits, and they are converted to double for f e g r. Old printf-style functions are not affected.
+  */
+
+#ifndef AVP_FORMAT_HPP_INCLUDED
+#define AVP_FORMAT_HPP_INCLUDED
+
+/// @cond
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <type_traits>
+#ifndef NO_STL
+#include <string>
+#endif
+/// @endcond
+#include "General.hpp"
+#include "Error.h"
+#include "NumConv.hpp"
+
+#ifndef AVP_FORMAT_BUFFER_SIZE
+#define AVP_FORMAT_BUFFER_SIZE 128 ///< stack buffer of format and debug_format, ending 0 included
+#endif
+
+/// makes a format type out of string literal
+#define AVP_FMT(s) ([]{ struct Fmt_ { static constexpr const char *Get() { return s; } }; return Fmt_{}; }())
+
+namespace avp {
+  namespace formatting {
+    enum Flags_ : uint8_t {LEFT = 1, PLUS = 2, SPACE = 4, ZERO = 8, ALT = 16};
+
+    /// literal text and conversion following it
+    struct Spec {
+      uint16_t LitStart, LitSize; ///< literal text in format string
+      char Conv; ///< 0 - no conversion, trailing literal
+      uint8_t Flags;
+      int16_t Width, Precision; ///< -1 - not specified
+    }; // Spec
+
+    constexpr bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+    constexpr bool IsLength(char c) { return c == 'h' || c == 'l' || c == 'L' || c == 'z' || c == 'j' || c == 't' || c == 'q'; }
+    constexpr bool IsConv(char c) {
+      for(const char *p = "diuoxXbcspfFeEgGr%"; *p != 0; ++p) if(*p == c) return true;
+      return false;
+    } // IsConv
+
+    /// @return number of conversions, %% included
+    constexpr size_t CountSpecs(const char *f) {
+      size_t N = 0;
+      for(; *f != 0; ++f)
+        if(*f == '%') {
+          ++N;
+          if(*++f == 0) break;
+          while(*f != 0 && !IsConv(*f)) ++f; // it may run away on bad format, Parse reports it
+          if(*f == 0) break;
+        }
+      return N;
+    } // CountSpecs
+
+    template<size_t N>
+    struct Table {
+      Spec S[N + 1]; ///< the last is trailing literal
+      size_t NumArgs; ///< conversions except %%
+      size_t LiteralSize; ///< total, %% included
+      bool OK; ///< format is parsed and supported
+    }; // Table
+
+    /**
+     * parses format into N + 1 specs, compile time or run time
+     * @param pS - N + 1 zeroed specs
+     * @return false if format is wrong or not supported or has not N conversions
+     */
+    constexpr bool ParseTo(const char *f, Spec *pS, size_t N, size_t *pNumArgs, size_t *pLiteralSize) {
+      size_t i = 0, Pos = 0, LitStart = 0;
+      for(;; ++i) {
+        while(f[Pos] != 0 && f[Pos] != '%') ++Pos;
+        Spec &S = pS[i];
+        S.LitStart = uint16_t(LitStart);
+        S.LitSize = uint16_t(Pos - LitStart);
+        S.Width = S.Precision = -1;
+        *pLiteralSize += S.LitSize;
+        if(f[Pos] == 0) break;
+        if(i == N) return false; // can not be
+        ++Pos;
+        for(;; ++Pos) {
+          if(f[Pos] == '-') S.Flags |= LEFT;
+          else if(f[Pos] == '+') S.Flags |= PLUS;
+          else if(f[Pos] == ' ') S.Flags |= SPACE;
+          else if(f[Pos] == '0') S.Flags |= ZERO;
+          else if(f[Pos] == '#') S.Flags |= ALT;
+          else break;
+        }
+        if(IsDigit(f[Pos])) for(S.Width = 0; IsDigit(f[Pos]); ++Pos) S.Width = int16_t(S.Width*10 + f[Pos] - '0');
+        if(f[Pos] == '.') for(S.Precision = 0, ++Pos; IsDigit(f[Pos]); ++Pos) S.Precision = int16_t(S.Precision*10 + f[Pos] - '0');
+        while(IsLength(f[Pos])) ++Pos;
+        if(!IsConv(f[Pos])) return false; // '*' gets here too
+        S.Conv = f[Pos++];
+        if(S.Conv == '%') ++*pLiteralSize; else ++*pNumArgs;
+        LitStart = Pos;
+      }
+      return i == N && Pos < UINT16_MAX;
+    } // ParseTo
+
+    template<size_t N>
+    constexpr Table<N> Parse(const char *f) {
+      Table<N> T{};
+      T.OK = ParseTo(f, T.S, N, &T.NumArgs, &T.LiteralSize);
+      return T;
+    } // Parse
+
+    /// argument with type erased, what formatter needs of it
+    struct Arg {
+      enum Kind_ : uint8_t {SIGNED, UNSIGNED, FLOAT, STRING, POINTER} Kind;
+      uint8_t Size; ///< sizeof of integer or floating point argument
+      union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const char *s;
+        const void *p;
+      };
+      size_t Len; ///< of string
+    }; // Arg
+
+    template<typename A>
+    constexpr bool IsString() {
+      typedef std::decay_t<A> D;
+#ifndef NO_STL
+      if(std::is_same_v<D, std::string>) return true;
+#endif
+      return std::is_same_v<D, char *> || std::is_same_v<D, const char *>;
+    } // IsString
+
+    /// argument type is good for conversion
+    template<typename A>
+    constexpr bool Compatible(char Conv) {
+      typedef std::decay_t<A> D;
+      constexpr bool Int = std::is_integral_v<D> || std::is_enum_v<D>;
+      switch(Conv) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'b': case 'c': return Int;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'r': return std::is_arithmetic_v<D>;
+        case 's': return IsString<A>();
+        case 'p': return std::is_pointer_v<D> || std::is_null_pointer_v<D>;
+        default: return false;
+      }
+    } // Compatible
+
+    template<typename A>
+    inline Arg MakeArg(const A &a) {
+      typedef std::decay_t<A> D;
+      Arg Out{};
+      if constexpr(IsString<A>()) {
+        Out.Kind = Arg::STRING;
+#ifndef NO_STL
+        if constexpr(std::is_same_v<D, std::string>) {
+          Out.s = a.c_str();
+          Out.Len = a.size();
+        } else
+#endif
+        if constexpr(std::is_array_v<A>) { // string literal, can not be null
+          Out.s = a;
+          Out.Len = strlen(Out.s);
+        } else {
+          Out.s = a == nullptr?"(null)":a;
+          Out.Len = strlen(Out.s);
+        }
+      } else if constexpr(std::is_pointer_v<D> || std::is_null_pointer_v<D>) {
+        Out.Kind = Arg::POINTER;
+        Out.p = (const void *)a;
+      } else if constexpr(std::is_floating_point_v<D>) {
+        Out.Kind = Arg::FLOAT;
+        Out.Size = sizeof(D);
+        Out.d = double(a);
+      } else if constexpr(std::is_enum_v<D>) return MakeArg(std::underlying_type_t<D>(a));
+      else if constexpr(std::is_signed_v<D>) {
+        Out.Kind = Arg::SIGNED;
+        Out.Size = sizeof(D);
+        Out.i = int64_t(a);
+      } else {
+        Out.Kind = Arg::UNSIGNED;
+        Out.Size = sizeof(D);
+        Out.u = uint64_t(a);
+      }
+      return Out;
+    } // MakeArg
+
+    constexpr bool IsFloatConv(char Conv) {
+      return Conv == 'f' || Conv == 'F' || Conv == 'e' || Conv == 'E' || Conv == 'g' || Conv == 'G' || Conv == 'r';
+    } // IsFloatConv
+
+    /// integer argument of float conversion
+    inline void ToFloat(Arg &A) {
+      if(A.Kind == Arg::SIGNED) A.d = double(A.i);
+      else if(A.Kind == Arg::UNSIGNED) A.d = double(A.u);
+      else return;
+      A.Kind = Arg::FLOAT;
+      A.Size = sizeof(double);
+    } // ToFloat
+
+    inline size_t Max(size_t a, int16_t b) { return b > 0 && size_t(b) > a?size_t(b):a; }
+
+    /// @return upper bound of conversion output size
+    inline size_t Bound(const Spec &S, const Arg &A) {
+      switch(S.Conv) {
+        case 'c': return Max(1, S.Width);
+        case 's': return Max(S.Precision >= 0 && size_t(S.Precision) < A.Len?size_t(S.Precision):A.Len, S.Width);
+        case 'p': return Max(2 + 2*sizeof(void *), S.Width);
+        case 'r': return Max(num_conv::MAX_SHORTEST, S.Width);
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': {
+          int Exp = 0;
+          if(isfinite(A.d)) frexp(A.d, &Exp);
+          // there are at most floor(Exp*log10(2)) + 1 integer digits, Exp*3/10 truncates log10(2) = 0.30103 and
+          // drops the fraction, but they lose less than 2 together while Exp <= 1024 (double), hence + 2
+          const size_t IntDigits = Exp > 0?size_t(Exp)*3/10 + 2:1;
+          return Max(IntDigits + (S.Precision < 0?6:S.Precision) + 8, S.Width); // sign, point, exponent, inf, nan
+        }
+        default: return Max(8*A.Size + 2 + (S.Precision > 0?S.Precision:0), S.Width); // binary digits, sign or prefix
+      }
+    } // Bound
+
+    /// output buffer, what does not fit is counted but not written, like snprintf does
+    struct Out {
+      char *Buf;
+      size_t Space; ///< ending 0 excluded
+      size_t Size; ///< of full output
+      void Put(const char *p, size_t n) {
+        if(Size < Space) memcpy(Buf + Size, p, Space - Size < n?Space - Size:n);
+        Size += n;
+      } // Put
+      void Fill(char c, size_t n) {
+        if(Size < Space) memset(Buf + Size, c, Space - Size < n?Space - Size:n);
+        Size += n;
+      } // Fill
+    }; // Out
+
+    /// pads Body of Size bytes with prefix (sign, 0x) to Width
+    /// @param ZeroPad - pad with zeros between prefix and body, unless padding is on the right
+    /// @param Zeros - leading zeros demanded by precision
+    inline void Pad(Out &O, const Spec &S, const char *Prefix, size_t PrefixSize, const char *Body, size_t Size,
+                    bool ZeroPad = false, size_t Zeros = 0) {
+      const size_t Total = PrefixSize + Zeros + Size;
+      const size_t Fill = S.Width > 0 && size_t(S.Width) > Total?S.Width - Total:0;
+      if(S.Flags & LEFT) ZeroPad = false;
+      else if(!ZeroPad) O.Fill(' ', Fill);
+      O.Put(Prefix, PrefixSize);
+      if(ZeroPad) O.Fill('0', Fill);
+      O.Fill('0', Zeros);
+      O.Put(Body, Size);
+      if(S.Flags & LEFT) O.Fill(' ', Fill);
+    } // Pad
+
+    inline void Integer(Out &O, const Spec &S, const Arg &A) {
+      char Prefix[2], Buffer[num_conv::MAX_BIN];
+      size_t PrefixSize = 0;
+      uint64_t x = A.u;
+      if(A.Kind == Arg::SIGNED && (S.Conv == 'd' || S.Conv == 'i')) {
+        if(A.i < 0) {
+          Prefix[PrefixSize++] = '-';
+          x = 0 - x;
+        } else if(S.Flags & PLUS) Prefix[PrefixSize++] = '+';
+        else if(S.Flags & SPACE) Prefix[PrefixSize++] = ' ';
+      } else if(A.Size < 8) x &= (uint64_t(1) << 8*A.Size) - 1; // the same bits as in argument type
+      char *pEnd = Buffer;
+      if(S.Precision != 0 || x != 0)
+        switch(S.Conv) {
+          case 'x': case 'X': pEnd = num_conv::UintToHex(x, Buffer, S.Conv == 'X'); break;
+          case 'o': pEnd = num_conv::UintToOct(x, Buffer); break;
+          case 'b': pEnd = num_conv::UintToBin(x, Buffer); break;
+          default: pEnd = num_conv::UintToDec(x, Buffer);
+        }
+      const size_t Size = pEnd - Buffer;
+      size_t Zeros = S.Precision > 0 && size_t(S.Precision) > Size?S.Precision - Size:0;
+      if(S.Flags & ALT && x != 0) {
+        if(S.Conv == 'o') { if(Zeros == 0) Zeros = 1; }
+        else if(S.Conv == 'x' || S.Conv == 'X' || S.Conv == 'b') {
+          Prefix[PrefixSize++] = '0';
+          Prefix[PrefixSize++] = S.Conv;
+        }
+      }
+      Pad(O, S, Prefix, PrefixSize, Buffer, Size, S.Flags & ZERO && S.Precision < 0, Zeros);
+    } // Integer
+
+    inline void Shortest(Out &O, const Spec &S, const Arg &A) {
+      char Prefix[1], Buffer[num_conv::MAX_SHORTEST];
+      char *pEnd = A.Size == sizeof(float)?num_conv::FloatToShortest(float(A.d), Buffer):num_conv::FloatToShortest(A.d, Buffer);
+      const char *pBody = Buffer;
+      size_t PrefixSize = 0;
+      if(*pBody == '-') {
+        Prefix[PrefixSize++] = *pBody++;
+      } else if(S.Flags & PLUS) Prefix[PrefixSize++] = '+';
+      else if(S.Flags & SPACE) Prefix[PrefixSize++] = ' ';
+      Pad(O, S, Prefix, PrefixSize, pBody, pEnd - pBody, S.Flags & ZERO && isfinite(A.d));
+    } // Shortest
+
+    inline void Float(Out &O, const Spec &S, const Arg &A) {
+      char Fmt[12], *f = Fmt;
+      *f++ = '%';
+      if(S.Flags & LEFT) *f++ = '-';
+      if(S.Flags & PLUS) *f++ = '+';
+      if(S.Flags & SPACE) *f++ = ' ';
+      if(S.Flags & ZERO) *f++ = '0';
+      if(S.Flags & ALT) *f++ = '#';
+      *f++ = '*';
+      *f++ = '.';
+      *f++ = '*';
+      *f++ = S.Conv;
+      *f = 0;
+      // ending 0 snprintf writes goes where the next output or ending 0 of Write goes
+      const int Size = O.Size < O.Space?snprintf(O.Buf + O.Size, O.Space - O.Size + 1, Fmt, int(S.Width),
+                                                 int(S.Precision < 0?6:S.Precision), A.d):
+                                        snprintf(nullptr, 0, Fmt, int(S.Width), int(S.Precision < 0?6:S.Precision), A.d);
+      if(Size > 0) O.Size += Size;
+    } // Float
+
+    /**
+     * formats everything in one pass, like snprintf
+     * @param Space - of Buf, ending 0 included, output is truncated to fit
+     * @return size of full output, ending 0 excluded
+     */
+    inline size_t Write(char *Buf, const char *Fmt, const Spec *S, const Arg *Args, size_t Space) {
+      Out O{Buf, Space == 0?0:Space - 1, 0};
+      for(;; ++S) {
+        O.Put(Fmt + S->LitStart, S->LitSize);
+        switch(S->Conv) {
+          case 0:
+            if(Space != 0) Buf[O.Size < O.Space?O.Size:O.Space] = 0;
+            return O.Size;
+          case '%': O.Put("%", 1); continue;
+          case 'c': {
+            const char c = char(Args->u);
+            Pad(O, *S, nullptr, 0, &c, 1);
+            break;
+          }
+          case 's': Pad(O, *S, nullptr, 0, Args->s, S->Precision >= 0 && size_t(S->Precision) < Args->Len?S->Precision:Args->Len); break;
+          case 'p':
+            if(Args->p == nullptr) Pad(O, *S, nullptr, 0, "(nil)", 5);
+            else {
+              char Buffer[num_conv::MAX_HEX];
+              Pad(O, *S, "0x", 2, Buffer, num_conv::UintToHex(uintptr_t(Args->p), Buffer) - Buffer);
+            }
+            break;
+          case 'r': Shortest(O, *S, *Args); break;
+          case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': Float(O, *S, *Args); break;
+          default: Integer(O, *S, *Args);
+        }
+        ++Args;
+      }
+    } // Write
+
+    /// everything about format known at compile time
+    template<class Fmt>
+    struct Parsed {
+      static constexpr const char *String = Fmt::Get();
+      static constexpr size_t N = CountSpecs(String);
+      static constexpr Table<N> T = Parse<N>(String);
+      static_assert(T.OK, "Format is wrong or not supported!");
+
+      template<typename... Args, size_t... I>
+      static constexpr bool Check(std::index_sequence<I...>) {
+        return (Compatible<Args>(T.S[ArgSpec(I)].Conv) && ...);
+      } // Check
+
+      /// @return index of spec of argument I
+      static constexpr size_t ArgSpec(size_t I) {
+        for(size_t i = 0; i < N; ++i)
+          if(T.S[i].Conv != '%' && I-- == 0) return i;
+        return N;
+      } // ArgSpec
+    }; // Parsed
+
+    /// holds arguments of a call, computes output bound
+    template<class Fmt, typename... Args>
+    struct Call {
+      typedef Parsed<Fmt> P;
+      static_assert(P::T.NumArgs == sizeof...(Args), "Number of arguments does not match format!");
+      static_assert(P::template Check<Args...>(std::index_sequence_for<Args...>{}), "Argument type does not match format!");
+
+      Arg A[sizeof...(Args) + 1]; // + 1, so it is never 0
+      size_t Size; ///< output bound, ending 0 excluded
+
+      explicit Call(const Args &... a): A{MakeArg(a)...} {
+        Size = P::T.LiteralSize;
+        for(size_t i = 0; i < sizeof...(Args); ++i) {
+          const Spec &S = P::T.S[P::ArgSpec(i)];
+          if(IsFloatConv(S.Conv)) ToFloat(A[i]);
+          Size += Bound(S, A[i]);
+        }
+      } // Call
+
+      /// @param Out - has at least Size + 1 bytes
+      size_t Write(char *Out) const { return formatting::Write(Out, P::String, P::T.S, A, Size + 1); }
+      /// @param Space - of Out, ending 0 included, output is truncated to fit
+      /// @return size of full output
+      size_t Write(char *Out, size_t Space) const { return formatting::Write(Out, P::String, P::T.S, A, Space); }
+    }; // Call
+  } // namespace formatting
+
+  /**
+   * formats into caller buffer, like snprintf
+   * @return size of full output, output is truncated if it is not less than BufSize
+   */
+  template<class Fmt, typename... Args>
+  size_t format_to(char *Buf, size_t BufSize, Fmt, const Args &... a) {
+    return formatting::Call<Fmt, Args...>(a...).Write(Buf, BufSize);
+  } // format_to
+
+  /// writes formatted text to sink with single call, ending 0 is not written
+  template<bool (*write)(const uint8_t *Ptr, size_t Size), class Fmt, typename... Args>
+  bool format(Fmt, const Args &... a) {
+    const formatting::Call<Fmt, Args...> C(a...);
+    char Buffer[AVP_FORMAT_BUFFER_SIZE];
+    const size_t Size = C.Write(Buffer, sizeof(Buffer));
+    if(Size < sizeof(Buffer)) return write((const uint8_t *)Buffer, Size);
+#ifndef NO_STL
+    std::string Long(Size, '\0');
+    C.Write(&Long[0], Size + 1);
+    return write((const uint8_t *)Long.data(), Size);
+#else
+    return write((const uint8_t *)Buffer, sizeof(Buffer) - 1); // truncated
+#endif
+  } // format
+
+  /// debug_printf replacement
+  template<class Fmt, typename... Args>
+  int debug_format(Fmt, const Args &... a) {
+    const formatting::Call<Fmt, Args...> C(a...);
+    char Buffer[AVP_FORMAT_BUFFER_SIZE];
+    if(C.Write(Buffer, sizeof(Buffer)) < sizeof(Buffer)) return debug_puts(Buffer);
+#ifndef NO_STL
+    std::string Long(C.Size, '\0');
+    C.Write(&Long[0]);
+    return debug_puts(Long.c_str());
+#else
+    return debug_puts(Buffer); // truncated
+#endif
+  } // debug_format
+
+#ifndef NO_STL
+  /// string_printf replacement
+  template<class Fmt, typename... Args>
+  std::string string_format(Fmt, const Args &... a) {
+    const formatting::Call<Fmt, Args...> C(a...);
+    std::string Out(C.Size, '\0'); // C++11 string has space for ending 0
+    Out.resize(C.Write(&Out[0]));
+    return Out;
+  } // string_format
+#endif
+} // namespace avp
+
+#endif /* AVP_FORMAT_HPP_INCLUDED */
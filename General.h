@@ -45,12 +45,17 @@ const char *svprintf_alloc(const char *format, va_list a) __attribute__ ((format
 const char *sprintf_alloc(char const *format, ...) __attribute__ ((format (printf, 1, 2)));
 
 /**
- * following two function return a pointer to the same memory every time, and reallocated the space for this memory as necessary
- * this memory does not need to be free"d"
+ * following two functions return a pointer to thread-local memory, which does not need to be free"d". On hosts it grows
+ * as necessary, on bare metal output is truncated to AVP_PRINTF_ARENA_SIZE.
+ * The pointer stays valid until AVP_PRINTF_NUM_ARENAS (2 on hosts, 1 on bare metal) more calls in the same thread
  */
 const char *svprintf_static(const char *format, va_list a) __attribute__ ((format (printf, 1, 0)));
 const char *sprintf_static(char const *format, ...) __attribute__ ((format (printf, 1, 2)));
 
+/**
+ * following two functions return a pointer to the same memory every time, and reallocate the space for this memory as
+ * necessary, this memory does not need to be free"d". The pointer stays valid until the next call in the same thread
+ */
 const char *svprintf_realloc(const char *format, va_list a) __attribute__ ((format (printf, 1, 0)));
 const char *sprintf_realloc(char const *format, ...) __attribute__ ((format (printf, 1, 2)));
 
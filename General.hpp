@@ -190,31 +190,37 @@ namespace avp {
   class DebugStreamBuf : public std::streambuf {
   public:
     DebugStreamBuf() {
-      // Initialize the put area (optional, but good practice)
-      setp(buffer_, buffer_ + sizeof(buffer_));
+      setp(buffer_, buffer_ + sizeof(buffer_) - 1); // the last byte is for ending 0 debug_puts needs
       std::cout.rdbuf(this);
       std::cerr.rdbuf(this);
     } // constructor
 
   protected:
-    // Called when a character needs to be written
+    /// writes what is collected with single debug_puts
+    void Flush() {
+      if(pptr() == pbase()) return;
+      *pptr() = 0;
+      debug_puts(pbase());
+      setp(buffer_, buffer_ + sizeof(buffer_) - 1);
+    } // Flush
+
+    // Called when put area is full
     int overflow(int c) override {
+      Flush();
       if(c != EOF) {
-        // Write the character to your byte-writing function
-        debug_putchar(static_cast<uint8_t>(c));
+        *pptr() = static_cast<char>(c);
+        pbump(1);
       }
       return c; // Return the character written (or EOF on error)
     }
 
     // Called when the stream is flushed (e.g., std::endl or std::flush)
     int sync() override {
-      // Optional: Add flushing logic if your destination requires it
-      // For example, flush a serial buffer or ensure data is sent
+      Flush();
       return 0; // Return 0 on success, -1 on failure
     }
 
   private:
-    // Optional: Small internal buffer to reduce calls to write_byte
     char buffer_[256]; // Adjust size based on your needs
   };
 #endif
@@ -13,11 +13,25 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <type_traits>
 /// @endcond
 #include "General.hpp"
 #include "Error.hpp"
 #include "MyTime.hpp"
 
+/// wait_yield and wait_event need threads
+#if !defined(NO_STL) && (defined(__linux__) || defined(_WIN32) || defined(__APPLE__))
+# define AVP_IO_THREADS 1
+/// @cond
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <chrono>
+/// @endcond
+#else
+# define AVP_IO_THREADS 0
+#endif
+
 namespace avp {
 //! @note ALL IO FUNCTIONS HAVE atomic output - either they write or not,
 //! return corresponding value
@@ -34,24 +48,104 @@ namespace avp {
   */
 
   /// generates write_type_func from write_byte_func
+  /// @tparam space_left - if given, nothing is written unless everything fits
   template<write_byte_func write_byte, size_t (*space_left)() = nullptr>
   bool write(const uint8_t *p, size_t sz) {
-    if(space_left != nullptr && sz < space_left()) return false;
+    if(space_left != nullptr && sz > space_left()) return false;
     for(; sz--;) if(!write_byte(*(p++))) return false; // it makes for non-atomic situation, but it should not happen
     return true;
   } // write
 
+  namespace io_detail {
+    template<class Sink, class = void> struct has_block_write: std::false_type {};
+    template<class Sink>
+    struct has_block_write<Sink, std::void_t<decltype(Sink::write((const uint8_t *)nullptr, size_t(0)))>>: std::true_type {};
+    template<class Sink, class = void> struct has_space_left: std::false_type {};
+    template<class Sink>
+    struct has_space_left<Sink, std::void_t<decltype(Sink::TX_SpaceLeft())>>: std::true_type {};
+  } // namespace io_detail
+
+  /**
+   * generates write_type_func from static sink class, e.g. Port. Block write of sink is used if it has one,
+   * otherwise bytes go one by one to its write_byte, after TX_SpaceLeft check if sink has it.
+   * @code
+   *   avp::printf<avp::write_to<MyPort>>("x=%d\n", x);
+   * @endcode
+   */
+  template<class Sink>
+  bool write_to(const uint8_t *p, size_t sz) {
+    if constexpr(io_detail::has_block_write<Sink>::value) return Sink::write(p, sz);
+    else if constexpr(io_detail::has_space_left<Sink>::value) return write<Sink::write_byte, Sink::TX_SpaceLeft>(p, sz);
+    else return write<Sink::write_byte>(p, sz);
+  } // write_to
+
+  /// @{
+  /**
+   * wait strategies of write_with_timeout. Mark() is taken before write attempt, Wait(Mark) is called when it fails.
+   * Wait should return in a short while, so timeout is checked.
+   */
+  /// busy loop, the only choice on bare metal, loop_func of write_with_timeout does the useful work
+  struct wait_spin {
+    static uint32_t Mark() { return 0; }
+    static void Wait(uint32_t) {}
+  }; // wait_spin
+
+#if AVP_IO_THREADS
+  /// gives CPU to other threads
+  struct wait_yield {
+    static uint32_t Mark() { return 0; }
+    static void Wait(uint32_t) { std::this_thread::yield(); }
+  }; // wait_yield
+
+  /**
+   * sleeps until sink calls Notify, e.g. from its transmitter thread when space is freed
+   * @tparam Tag - separates events of different sinks
+   * @tparam MaxWaitMs - longest sleep, so timeout is checked even if sink never notifies
+   * @code
+   *   typedef avp::wait_event<MyPort> Writable; // MyPort TX thread calls Writable::Notify()
+   *   avp::write_with_timeout<MyPort::write, 1000, millis, nullptr, Writable>(p, Size);
+   * @endcode
+   */
+  template<class Tag = void, uint32_t MaxWaitMs = 10>
+  class wait_event {
+    static inline std::mutex Lock;
+    static inline std::condition_variable Cond;
+    static inline uint32_t Generation = 0;
+   public:
+    static void Notify() {
+      {
+        std::lock_guard<std::mutex> L(Lock);
+        ++Generation;
+      }
+      Cond.notify_all();
+    } // Notify
+    static uint32_t Mark() {
+      std::lock_guard<std::mutex> L(Lock);
+      return Generation;
+    } // Mark
+    /// returns when notified after Mark was taken
+    static void Wait(uint32_t Mark) {
+      std::unique_lock<std::mutex> L(Lock);
+      Cond.wait_for(L, std::chrono::milliseconds(MaxWaitMs), [Mark] { return Generation != Mark; });
+    } // Wait
+  }; // wait_event
+#endif
+  /// @}
+
   /// function which allows to write something with timeout and call loop function while write is pending
+  /// @tparam Wait - what to do between write attempts, see wait_spin
   /// @return true - succeess, false - timeout
   template<write_type_func write_func, uint32_t Timeout = 1000, uint32_t (*TickFunction)() = millis,
-           void (*loop_func)() = nullptr>
+           void (*loop_func)() = nullptr, class Wait = wait_spin>
   bool write_with_timeout(const uint8_t *Ptr, size_t Size)  {
     TimeOut<TickFunction> T(Timeout);
-    while(!write_func(Ptr,Size)) {
+    for(;;) {
+      const uint32_t Mark = Wait::Mark();
+      if(write_func(Ptr,Size)) return true;
       if(loop_func != nullptr) loop_func();
       if(T) return false;
-    };
-    return true;
+      Wait::Wait(Mark);
+    }
   } // write_with_timeout
 
   /** object to create misc output functions - very convenient to use with typedef which we can not do
@@ -65,7 +159,10 @@ namespace avp {
     static bool string(const char *str) { return  write_((const uint8_t *)str,strlen(str)); }
 
     static bool vprintf(char const *format, va_list ap) {
-      int Size = vsnprintf(NULL,0,format,ap);
+      va_list ap_;
+      va_copy(ap_, ap); // vsnprintf is changing ap, so we have to make a reserve copy
+      int Size = vsnprintf(NULL,0,format,ap_);
+      va_end(ap_);
       AVP_ASSERT_WITH_EXPL(Size >= 0,"vprintf: Format %s is bad!",format);
       uint8_t Buffer[Size+1]; // +1 to include ending zero byte
       vsprintf((char *)Buffer,format,ap);
@@ -0,0 +1,215 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief record-oriented variant of ISR_Message: timestamped records with severity and source ID, whole or nothing,
+  and per-source rate limit, so a noisy ISR does not fill the log with partial lines of its own.
+  */
+
+#ifndef AVP_ISR_LOG_HPP_INCLUDED
+#define AVP_ISR_LOG_HPP_INCLUDED
+
+/// @cond
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+/// @endcond
+#include "Macros.h"
+#include "Format.hpp"
+#include "millis_micros.hpp"
+
+/// ISR_Log ring space is reserved by compare-and-swap, so ISRs of different priorities may log into the same ring
+/// It is on by default only where 32-bit compare-and-swap is lock-free, so it is off e.g. on AVR and ARMv6-M
+/// (Cortex-M0/M0+), where it is a libcall which is missing or not ISR-safe
+#ifndef AVP_ISR_LOG_MULTI_WRITER
+# if defined(__GCC_ATOMIC_INT_LOCK_FREE) && __GCC_ATOMIC_INT_LOCK_FREE == 2 && !defined(__ARM_ARCH_6M__)
+#  define AVP_ISR_LOG_MULTI_WRITER 1
+# else
+#  define AVP_ISR_LOG_MULTI_WRITER 0
+# endif
+#endif
+
+namespace avp {
+  namespace isr_log {
+    enum Severity : uint8_t {ERR, WARN, INFO, DBG};
+
+    /// record header, text follows
+    struct Header {
+      uint8_t Committed; ///< 0 until record is complete, ring is zeroed after reading
+      uint8_t Severity;
+      uint8_t Source;
+      uint8_t Size; ///< of text
+      uint16_t Suppressed; ///< messages of this source dropped before this one, by rate limit or full ring
+      uint32_t Time;
+    }; // Header
+  } // namespace isr_log
+
+  /**
+   * record-oriented ISR log: every message is length-prefixed record with timestamp, severity and source ID. Record
+   * space is reserved at once and record is committed when complete, so reader never sees partial lines, and a
+   * record which does not fit is dropped whole. Every source is rate-limited by token bucket: Burst messages at
+   * once, then one per RefillPeriod, the number of dropped messages comes with the next record of this source.
+   * @code
+   *   typedef avp::ISR_Log<10, 4> Log; // source IDs 0..3
+   *   Log::format(UART_SRC, avp::isr_log::WARN, AVP_FMT("overrun %u"), n); // in ISR
+   *   Log::call_in_loop(log_func); // in main loop, gets "  12345678 W 1: overrun 3\n"
+   * @endcode
+   * @tparam Clock - timestamp and rate limit time source, e.g. cycle counter
+   * @tparam RefillPeriod - in Clock units
+   * @note a source should log from one ISR or thread, its rate limit state is not shared safely
+   */
+  template<uint8_t sizeLog2, uint8_t NumSources, uint32_t (*Clock)() = micros, uint8_t Burst = 8,
+           uint32_t RefillPeriod = 10000>
+  struct ISR_Log {
+    static constexpr uint32_t Size = uint32_t(1) << sizeLog2;
+    static constexpr uint32_t Mask = Size - 1;
+    static_assert(sizeof(isr_log::Header) + UINT8_MAX < Size, "Ring is too small for the longest record!");
+
+   protected:
+    static inline uint8_t Data[Size]; ///< zero where nothing is written
+    static inline uint32_t Reserved = 0, Tail = 0; ///< free running
+
+    struct Limit {
+      uint32_t LastRefill;
+      uint8_t Tokens;
+      bool Started;
+      uint16_t Suppressed;
+    }; // Limit
+    static inline Limit Limits[NumSources];
+
+    static void Put(uint32_t Pos, const void *p, uint32_t n) {
+      const uint32_t Start = Pos & Mask, First = Size - Start;
+      if(n <= First) memcpy(Data + Start, p, n);
+      else {
+        memcpy(Data + Start, p, First);
+        memcpy(Data, (const uint8_t *)p + First, n - First);
+      }
+    } // Put
+    static void Get(uint32_t Pos, void *p, uint32_t n) {
+      const uint32_t Start = Pos & Mask, First = Size - Start;
+      if(n <= First) memcpy(p, Data + Start, n);
+      else {
+        memcpy(p, Data + Start, First);
+        memcpy((uint8_t *)p + First, Data, n - First);
+      }
+    } // Get
+    static void Zero(uint32_t Pos, uint32_t n) {
+      const uint32_t Start = Pos & Mask, First = Size - Start;
+      if(n <= First) memset(Data + Start, 0, n);
+      else {
+        memset(Data + Start, 0, First);
+        memset(Data, 0, n - First);
+      }
+    } // Zero
+
+    /// @return start of reserved space, or false if there is no space
+    static FORCE_INLINE bool Reserve(uint32_t n, uint32_t *pPos) {
+#if AVP_ISR_LOG_MULTI_WRITER
+      uint32_t Pos = __atomic_load_n(&Reserved, __ATOMIC_RELAXED);
+      do {
+        if(Pos + n - __atomic_load_n(&Tail, __ATOMIC_ACQUIRE) > Size) return false;
+      } while(!__atomic_compare_exchange_n(&Reserved, &Pos, Pos + n, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+      *pPos = Pos;
+#else
+      if(Reserved + n - *(volatile uint32_t *)&Tail > Size) return false;
+      *pPos = Reserved;
+      Reserved += n;
+#endif
+      return true;
+    } // Reserve
+
+    /// refills token bucket of source, token is taken only when record is written
+    static FORCE_INLINE bool Allow(Limit &L, uint32_t Now) {
+      if(!L.Started) {
+        L.Started = true;
+        L.Tokens = Burst;
+        L.LastRefill = Now;
+      } else if(const uint32_t New = (Now - L.LastRefill)/RefillPeriod) {
+        L.Tokens = New >= uint32_t(Burst - L.Tokens)?Burst:uint8_t(L.Tokens + New);
+        L.LastRefill += New*RefillPeriod;
+      }
+      return L.Tokens != 0;
+    } // Allow
+
+   public:
+    /// @return false if message was dropped
+    static FORCE_INLINE bool Log(uint8_t Source, uint8_t Severity, const char *Text, size_t TextSize) {
+      if(Source >= NumSources) return false;
+      Limit &L = Limits[Source];
+      const uint32_t Now = Clock();
+      uint32_t Pos;
+      if(!Allow(L, Now) || !Reserve(sizeof(isr_log::Header) + (TextSize > UINT8_MAX?UINT8_MAX:TextSize), &Pos)) {
+        if(L.Suppressed != UINT16_MAX) ++L.Suppressed;
+        return false;
+      }
+      --L.Tokens;
+      isr_log::Header H;
+      H.Committed = 0;
+      H.Severity = Severity;
+      H.Source = Source;
+      H.Size = uint8_t(TextSize > UINT8_MAX?UINT8_MAX:TextSize);
+      H.Suppressed = L.Suppressed;
+      H.Time = Now;
+      L.Suppressed = 0;
+      Put(Pos + 1, (const uint8_t *)&H + 1, sizeof(H) - 1);
+      Put(Pos + sizeof(H), Text, H.Size);
+#if AVP_ISR_LOG_MULTI_WRITER
+      __atomic_store_n(&Data[Pos & Mask], uint8_t(1), __ATOMIC_RELEASE);
+#else
+      *(volatile uint8_t *)&Data[Pos & Mask] = 1;
+#endif
+      return true;
+    } // Log
+
+    static FORCE_INLINE bool Log(uint8_t Source, uint8_t Severity, const char *Text) {
+      return Log(Source, Severity, Text, strlen(Text));
+    } // Log
+
+    /// format of Format.hpp, text is cut to UINT8_MAX bytes like in Log
+    template<class Fmt, typename... Args>
+    static FORCE_INLINE bool format(uint8_t Source, uint8_t Severity, Fmt, const Args &... a) {
+      char Text[UINT8_MAX + 1];
+      return Log(Source, Severity, Text, formatting::Call<Fmt, Args...>(a...).Write(Text, sizeof(Text)));
+    } // format
+
+    /**
+     * reads the oldest committed record
+     * @param Text - UINT8_MAX + 1 bytes, gets 0 terminated text
+     * @return false if there is none
+     */
+    static bool Next(isr_log::Header *pH, char *Text) {
+#if AVP_ISR_LOG_MULTI_WRITER
+      const uint32_t End = __atomic_load_n(&Reserved, __ATOMIC_ACQUIRE);
+      if(Tail == End || __atomic_load_n(&Data[Tail & Mask], __ATOMIC_ACQUIRE) == 0) return false;
+#else
+      if(Tail == *(volatile uint32_t *)&Reserved || *(volatile uint8_t *)&Data[Tail & Mask] == 0) return false;
+#endif
+      Get(Tail, pH, sizeof(*pH));
+      Get(Tail + sizeof(*pH), Text, pH->Size);
+      Text[pH->Size] = 0;
+      const uint32_t n = sizeof(*pH) + pH->Size;
+      Zero(Tail, n); // so stale bytes never look committed
+#if AVP_ISR_LOG_MULTI_WRITER
+      __atomic_store_n(&Tail, Tail + n, __ATOMIC_RELEASE);
+#else
+      *(volatile uint32_t *)&Tail = Tail + n;
+#endif
+      return true;
+    } // Next
+
+    /// Should be called in loop. Calls log_func with every committed record as text line
+    static void call_in_loop(void (*log_func)(const char *s, int sz)) {
+      isr_log::Header H;
+      char Text[UINT8_MAX + 1], Line[UINT8_MAX + 64];
+      while(Next(&H, Text)) {
+        int n = snprintf(Line, sizeof(Line), "%10lu %c %u: %s", (unsigned long)H.Time,
+                         H.Severity < 4?"EWID"[H.Severity]:'?', unsigned(H.Source), Text);
+        if(H.Suppressed != 0) n += snprintf(Line + n, sizeof(Line) - n, " (%u suppressed)", unsigned(H.Suppressed));
+        Line[n++] = '\n';
+        log_func(Line, n);
+      }
+    } // call_in_loop
+  }; // ISR_Log
+} // namespace avp
+
+#endif /* AVP_ISR_LOG_HPP_INCLUDED */
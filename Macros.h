@@ -27,6 +27,19 @@
 
 #define SINGLE_ARG(...) __VA_ARGS__ // in case there a commas in arguments to a macro
 
+// thread local storage on hosts. Bare metal targets usually have no TLS support and just one thread, so it is empty there
+#ifndef AVP_THREAD_LOCAL
+# if defined(__linux__) || defined(_WIN32) || defined(__APPLE__)
+#  ifdef __cplusplus
+#   define AVP_THREAD_LOCAL thread_local
+#  else
+#   define AVP_THREAD_LOCAL _Thread_local
+#  endif
+# else
+#  define AVP_THREAD_LOCAL
+# endif
+#endif
+
 // things to suppress warning for a bit
 // how it really works
 //         #pragma GCC diagnostic push
@@ -0,0 +1,232 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief log sink writing into memory-mapped file, so the log survives crash of the process.
+
+  Records go into a ring in a file mapped with MAP_SHARED, they are in the page cache as soon as they are copied and
+  the kernel writes them to the file even if the process dies right after, there is no write syscall or fsync on the
+  way. The file starts with a header holding the write cursor, the ring is append-only and the oldest records are
+  overwritten. MappedLog has write(Ptr, Size) of write_type_func, so it can be a sink of BG_message, BG_messageMT,
+  write_to etc:
+  @code
+    typedef avp::MappedLog<> CrashLog;
+    CrashLog::Open("/tmp/app.log", 20); // 1 MB ring
+    typedef avp::BG_message<CrashLog::write, 1024> Msg;
+  @endcode
+  After the crash the last records are extracted by MappedLogReader, see mapped_log_dump.cpp:
+  @code
+    mapped_log_dump /tmp/app.log 100
+  @endcode
+  Every write is a record framed by {position, size} before and after, so the reader walks back from the cursor and
+  skips a record which was reserved but not finished when the process died.
+  @note survives process death, not power loss or OS crash, Sync() is there for those
+  */
+
+#ifndef AVP_MAPPEDLOG_HPP_INCLUDED
+#define AVP_MAPPEDLOG_HPP_INCLUDED
+
+#if defined(__linux__) || defined(__APPLE__)
+
+/// @cond
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+/// @endcond
+
+namespace avp {
+  namespace mapped_log {
+    constexpr char Magic[8] = {'A', 'V', 'P', 'M', 'L', 'O', 'G', '1'};
+
+    /// file header, ring follows
+    struct Header {
+      char Magic[8];
+      uint32_t SizeLog2; ///< of ring
+      uint32_t HeaderSize;
+      uint64_t Head; ///< free running write cursor
+      uint8_t Reserved[40]; ///< so ring starts at 64
+    }; // Header
+    static_assert(sizeof(Header) == 64, "Header size changed!");
+
+    /// before and after record data
+    struct Frame {
+      uint32_t Pos; ///< low bits of record start position, so stale and torn frames do not match
+      uint32_t Size; ///< of data
+    }; // Frame
+
+    inline uint64_t RecordSize(uint32_t DataSize) { return 2*sizeof(Frame) + ((uint64_t(DataSize) + 7) & ~uint64_t(7)); }
+
+    /// maps file, @return mapped header or nullptr
+    inline Header *Map(const char *Path, bool Write, size_t *pSize) {
+      const int fd = open(Path, Write?O_RDWR | O_CREAT:O_RDONLY, 0644);
+      if(fd < 0) return nullptr;
+      Header *p = nullptr;
+      struct stat S;
+      if(fstat(fd, &S) == 0 && (Write || size_t(S.st_size) >= sizeof(Header)) &&
+         (!Write || *pSize == size_t(S.st_size) || ftruncate(fd, *pSize) == 0)) {
+        if(!Write) *pSize = S.st_size;
+        void *m = mmap(nullptr, *pSize, Write?PROT_READ | PROT_WRITE:PROT_READ, MAP_SHARED, fd, 0);
+        if(m != MAP_FAILED) p = (Header *)m;
+      }
+      close(fd); // mapping stays
+      return p;
+    } // Map
+  } // namespace mapped_log
+
+  /**
+   * static sink, Tag makes separate logs
+   */
+  template<class Tag = void>
+  class MappedLog {
+    static inline mapped_log::Header *pH = nullptr;
+    static inline uint8_t *Ring = nullptr;
+    static inline uint64_t Mask = 0;
+    static inline size_t MapSize = 0;
+
+    static void Put(uint64_t Pos, const void *p, size_t n) {
+      const uint64_t Start = Pos & Mask, First = Mask + 1 - Start;
+      if(n <= First) memcpy(Ring + Start, p, n);
+      else {
+        memcpy(Ring + Start, p, First);
+        memcpy(Ring, (const uint8_t *)p + First, n - First);
+      }
+    } // Put
+  public:
+    /**
+     * opens existing log and goes on appending to it, or creates new one
+     * @param sizeLog2 - log2 of ring size, log with different size is started anew
+     */
+    static bool Open(const char *Path, uint8_t sizeLog2) {
+      Close();
+      size_t Size = sizeof(mapped_log::Header) + (size_t(1) << sizeLog2);
+      mapped_log::Header *p = mapped_log::Map(Path, true, &Size);
+      if(p == nullptr) return false;
+      if(memcmp(p->Magic, mapped_log::Magic, sizeof(p->Magic)) != 0 || p->SizeLog2 != sizeLog2 ||
+         p->HeaderSize != sizeof(mapped_log::Header)) {
+        memset(p, 0, sizeof(*p));
+        p->SizeLog2 = sizeLog2;
+        p->HeaderSize = sizeof(mapped_log::Header);
+        memcpy(p->Magic, mapped_log::Magic, sizeof(p->Magic)); // the last, so half-initialized header is not valid
+      }
+      Ring = (uint8_t *)p + sizeof(*p);
+      Mask = (uint64_t(1) << sizeLog2) - 1;
+      MapSize = Size;
+      pH = p;
+      return true;
+    } // Open
+
+    static void Close() {
+      if(pH == nullptr) return;
+      munmap(pH, MapSize);
+      pH = nullptr;
+    } // Close
+
+    static bool is_open() { return pH != nullptr; }
+
+    /// writes to disk, only needed to survive OS crash, blocks
+    static bool Sync() { return pH != nullptr && msync(pH, MapSize, MS_SYNC) == 0; }
+
+    /// appends record, can be called from many threads
+    static bool write(const uint8_t *Ptr, size_t Size) {
+      if(pH == nullptr || Size > UINT32_MAX) return false;
+      const uint64_t n = mapped_log::RecordSize(uint32_t(Size));
+      if(n > Mask + 1) return false;
+      const uint64_t Pos = __atomic_fetch_add(&pH->Head, n, __ATOMIC_RELAXED);
+      const mapped_log::Frame F = {uint32_t(Pos), uint32_t(Size)};
+      Put(Pos, &F, sizeof(F));
+      Put(Pos + sizeof(F), Ptr, Size);
+      Put(Pos + n - sizeof(F), &F, sizeof(F));
+      return true;
+    } // write
+  }; // class MappedLog
+
+  /// reads log written by MappedLog, e.g. after the crash
+  class MappedLogReader {
+    const mapped_log::Header *pH = nullptr;
+    const uint8_t *Ring;
+    uint64_t Mask;
+    size_t MapSize;
+
+    void Get(uint64_t Pos, void *p, size_t n) const {
+      const uint64_t Start = Pos & Mask, First = Mask + 1 - Start;
+      if(n <= First) memcpy(p, Ring + Start, n);
+      else {
+        memcpy(p, Ring + Start, First);
+        memcpy((uint8_t *)p + First, Ring, n - First);
+      }
+    } // Get
+  public:
+    struct Record {
+      uint64_t Pos; ///< position in the log
+      std::vector<uint8_t> Data;
+    }; // Record
+
+    ~MappedLogReader() { Close(); }
+
+    bool Open(const char *Path) {
+      Close();
+      size_t Size;
+      pH = mapped_log::Map(Path, false, &Size);
+      if(pH == nullptr) return false;
+      if(memcmp(pH->Magic, mapped_log::Magic, sizeof(pH->Magic)) != 0 || pH->SizeLog2 > 48 ||
+         pH->HeaderSize < sizeof(mapped_log::Header) ||
+         Size < pH->HeaderSize + (size_t(1) << pH->SizeLog2)) {
+        munmap((void *)pH, Size);
+        pH = nullptr;
+        return false;
+      }
+      Ring = (const uint8_t *)pH + pH->HeaderSize;
+      Mask = (uint64_t(1) << pH->SizeLog2) - 1;
+      MapSize = Size;
+      return true;
+    } // Open
+
+    void Close() {
+      if(pH == nullptr) return;
+      munmap((void *)pH, MapSize);
+      pH = nullptr;
+    } // Close
+
+    /**
+     * @param N - number of records, the last ones
+     * @param pSkipped - gets number of bytes which did not make valid records, torn writes
+     * @return records, oldest first
+     */
+    std::vector<Record> Last(size_t N, uint64_t *pSkipped = nullptr) const {
+      std::vector<Record> R;
+      uint64_t Skipped = 0;
+      if(pH != nullptr) {
+        const uint64_t Head = __atomic_load_n(&pH->Head, __ATOMIC_ACQUIRE) & ~uint64_t(7);
+        const uint64_t Oldest = Head > Mask + 1?Head - (Mask + 1):0;
+        for(uint64_t End = Head; R.size() < N && End >= Oldest + 2*sizeof(mapped_log::Frame);) {
+          mapped_log::Frame T, F;
+          Get(End - sizeof(T), &T, sizeof(T));
+          const uint64_t n = mapped_log::RecordSize(T.Size);
+          if(n <= End - Oldest) {
+            const uint64_t Start = End - n;
+            Get(Start, &F, sizeof(F));
+            if(T.Pos == uint32_t(Start) && F.Pos == T.Pos && F.Size == T.Size) {
+              Record Rec = {Start, std::vector<uint8_t>(T.Size)};
+              Get(Start + sizeof(F), Rec.Data.data(), T.Size);
+              R.push_back(std::move(Rec));
+              End = Start;
+              continue;
+            }
+          }
+          End -= 8; // torn or unfinished record, looking for the end of the previous one
+          Skipped += 8;
+        }
+      }
+      if(pSkipped != nullptr) *pSkipped = Skipped;
+      return std::vector<Record>(R.rbegin(), R.rend());
+    } // Last
+  }; // class MappedLogReader
+} // namespace avp
+
+#endif // defined(__linux__) || defined(__APPLE__)
+
+#endif /* AVP_MAPPEDLOG_HPP_INCLUDED */
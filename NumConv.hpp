@@ -0,0 +1,381 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief integer and floating point to text conversion into caller buffer.
+
+  Decimal conversion makes two digits per division with a lookup table, hex and binary ones take digits straight
+  from bits with no branches and no rotation. Floating point numbers are printed with a digit sequence which reads
+  back to the same value and is almost always the shortest one (Grisu2 algorithm by F. Loitsch, with float numbers
+  using float neighbors, so they read back by strtof). Grisu2 has no exact fallback, so about 0.1% of numbers get a
+  digit or two more than needed, e.g. 1e23 is printed as 9.999999999999999e+22. No libc printf is involved.
+  Functions do not write ending 0 and return pointer past the last written character. Used by debug_put_* functions
+  in Error.hpp and by Format.hpp.
+  */
+
+#ifndef AVP_NUMCONV_HPP_INCLUDED
+#define AVP_NUMCONV_HPP_INCLUDED
+
+/// @cond
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+#include <limits>
+#include <cmath>
+/// @endcond
+
+namespace avp {
+  namespace num_conv {
+    /// buffer sizes enough for any value
+    enum MaxSizes_ {MAX_DEC = 20, MAX_INT_DEC = 21, MAX_HEX = 16, MAX_BIN = 64, MAX_SHORTEST = 25};
+
+    inline constexpr char DigitPairs[] =
+      "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+      "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+      "8081828384858687888990919293949596979899";
+
+    /// @return number of decimal digits of x, 1 for 0
+    inline uint8_t DecDigits(uint64_t x) {
+      uint8_t n = 1;
+      for(;;) { // four digits per step
+        if(x < 10) return n;
+        if(x < 100) return n + 1;
+        if(x < 1000) return n + 2;
+        if(x < 10000) return n + 3;
+        x /= 10000U;
+        n += 4;
+      }
+    } // DecDigits
+
+    /// writes exactly NumDigits least significant digits of x backward ending at pEnd
+    inline void DecBackward(uint64_t x, char *pEnd, uint8_t NumDigits) {
+      for(; NumDigits >= 2; NumDigits -= 2) {
+        const unsigned i = unsigned(x % 100U)*2;
+        x /= 100U;
+        *--pEnd = DigitPairs[i + 1];
+        *--pEnd = DigitPairs[i];
+      }
+      if(NumDigits != 0) *--pEnd = char('0' + x % 10U);
+    } // DecBackward
+
+    /// @param Upper - use upper case letters
+    inline char HexDigit(unsigned n, bool Upper = false) {
+      // (9 - n) is negative for letters, so shift gives all ones mask
+      return char('0' + n + (unsigned(int(9 - n) >> 8) & ((Upper?'A':'a') - '0' - 10)));
+    } // HexDigit
+
+    /// @{
+    /// @param MinDigits - pad with leading zeros to this number of digits
+    inline char *UintToDec(uint64_t x, char *p, uint8_t MinDigits = 1) {
+      uint8_t n = DecDigits(x);
+      if(n < MinDigits) n = MinDigits;
+      DecBackward(x, p + n, n);
+      return p + n;
+    } // UintToDec
+
+    inline char *IntToDec(int64_t x, char *p) {
+      if(x < 0) {
+        *p++ = '-';
+        return UintToDec(0 - uint64_t(x), p);
+      }
+      return UintToDec(uint64_t(x), p);
+    } // IntToDec
+
+    inline char *UintToHex(uint64_t x, char *p, bool Upper = false, uint8_t MinDigits = 1) {
+      uint8_t n = 1;
+      while(n < 16 && (x >> 4*n) != 0) ++n;
+      if(n < MinDigits) n = MinDigits;
+      for(uint8_t i = n; i != 0; x >>= 4) p[--i] = HexDigit(unsigned(x & 0xF), Upper);
+      return p + n;
+    } // UintToHex
+
+    inline char *UintToOct(uint64_t x, char *p, uint8_t MinDigits = 1) {
+      uint8_t n = 1;
+      while(n < 22 && (x >> 3*n) != 0) ++n;
+      if(n < MinDigits) n = MinDigits;
+      for(uint8_t i = n; i != 0; x >>= 3) p[--i] = char('0' + (x & 7));
+      return p + n;
+    } // UintToOct
+
+    inline char *UintToBin(uint64_t x, char *p, uint8_t MinDigits = 1) {
+      uint8_t n = 1;
+      while(n < 64 && (x >> n) != 0) ++n;
+      if(n < MinDigits) n = MinDigits;
+      for(uint8_t i = n; i != 0; x >>= 1) p[--i] = char('0' + (x & 1));
+      return p + n;
+    } // UintToBin
+    /// @}
+
+    namespace grisu {
+      /// floating point number f * 2^e with 64-bit significand
+      struct DiyFp {
+        uint64_t f;
+        int e;
+
+        static DiyFp Sub(DiyFp x, DiyFp y) { return DiyFp{x.f - y.f, x.e}; }
+
+        /// rounded upper 64 bits of 128-bit product
+        static DiyFp Mul(DiyFp x, DiyFp y) {
+          const uint64_t xl = x.f & 0xFFFFFFFFU, xh = x.f >> 32, yl = y.f & 0xFFFFFFFFU, yh = y.f >> 32;
+          const uint64_t p0 = xl*yl, p1 = xl*yh, p2 = xh*yl, p3 = xh*yh;
+          uint64_t Q = (p0 >> 32) + (p1 & 0xFFFFFFFFU) + (p2 & 0xFFFFFFFFU);
+          Q += uint64_t(1) << 31;
+          return DiyFp{p3 + (p1 >> 32) + (p2 >> 32) + (Q >> 32), x.e + y.e + 64};
+        } // Mul
+
+        static DiyFp Normalize(DiyFp x) {
+          while((x.f >> 63) == 0) {
+            x.f <<= 1;
+            --x.e;
+          }
+          return x;
+        } // Normalize
+      }; // DiyFp
+
+      /// value and its boundaries - halfway points to neighbors
+      struct Boundaries {
+        DiyFp w, Minus, Plus;
+      }; // Boundaries
+
+      template<typename F>
+      Boundaries GetBoundaries(F Value) {
+        static_assert(std::is_same_v<F, float> || std::is_same_v<F, double>, "Only IEEE float and double!");
+        constexpr bool Single = sizeof(F) == sizeof(uint32_t); // double is single precision on AVR
+        constexpr int Precision = Single?24:53; // with hidden bit
+        constexpr int Bias = (Single?127:1023) + Precision - 1;
+        constexpr uint64_t HiddenBit = uint64_t(1) << (Precision - 1);
+        typedef std::conditional_t<Single, uint32_t, uint64_t> tBits;
+        static_assert(sizeof(F) == sizeof(tBits) && std::numeric_limits<F>::digits == Precision, "Only IEEE float and double!");
+        tBits Bits;
+        memcpy(&Bits, &Value, sizeof(Bits));
+        const uint64_t E = Bits >> (Precision - 1), Fr = Bits & (HiddenBit - 1);
+        const DiyFp v = E == 0?DiyFp{Fr, 1 - Bias}:DiyFp{Fr + HiddenBit, int(E) - Bias};
+        // lower neighbor is closer when significand is power of 2
+        const bool LowerCloser = Fr == 0 && E > 1;
+        const DiyFp Plus = DiyFp::Normalize(DiyFp{2*v.f + 1, v.e - 1});
+        DiyFp Minus = LowerCloser?DiyFp{4*v.f - 1, v.e - 2}:DiyFp{2*v.f - 1, v.e - 1};
+        Minus.f <<= Minus.e - Plus.e;
+        Minus.e = Plus.e;
+        return Boundaries{DiyFp::Normalize(v), Minus, Plus};
+      } // GetBoundaries
+
+      struct CachedPower {
+        uint64_t f;
+        int e, k; ///< 10^k == f * 2^e
+      }; // CachedPower
+
+      constexpr int Alpha = -60, Gamma = -32; ///< binary exponent range of scaled value
+
+      /// @return c = 10^-k, so that Alpha <= e + c.e + 64 <= Gamma
+      inline CachedPower GetCachedPower(int e) {
+        static constexpr CachedPower Powers[] = {
+          {0xAB70FE17C79AC6CAULL, -1060, -300},
+          {0xFF77B1FCBEBCDC4FULL, -1034, -292},
+          {0xBE5691EF416BD60CULL, -1007, -284},
+          {0x8DD01FAD907FFC3CULL, -980, -276},
+          {0xD3515C2831559A83ULL, -954, -268},
+          {0x9D71AC8FADA6C9B5ULL, -927, -260},
+          {0xEA9C227723EE8BCBULL, -901, -252},
+          {0xAECC49914078536DULL, -874, -244},
+          {0x823C12795DB6CE57ULL, -847, -236},
+          {0xC21094364DFB5637ULL, -821, -228},
+          {0x9096EA6F3848984FULL, -794, -220},
+          {0xD77485CB25823AC7ULL, -768, -212},
+          {0xA086CFCD97BF97F4ULL, -741, -204},
+          {0xEF340A98172AACE5ULL, -715, -196},
+          {0xB23867FB2A35B28EULL, -688, -188},
+          {0x84C8D4DFD2C63F3BULL, -661, -180},
+          {0xC5DD44271AD3CDBAULL, -635, -172},
+          {0x936B9FCEBB25C996ULL, -608, -164},
+          {0xDBAC6C247D62A584ULL, -582, -156},
+          {0xA3AB66580D5FDAF6ULL, -555, -148},
+          {0xF3E2F893DEC3F126ULL, -529, -140},
+          {0xB5B5ADA8AAFF80B8ULL, -502, -132},
+          {0x87625F056C7C4A8BULL, -475, -124},
+          {0xC9BCFF6034C13053ULL, -449, -116},
+          {0x964E858C91BA2655ULL, -422, -108},
+          {0xDFF9772470297EBDULL, -396, -100},
+          {0xA6DFBD9FB8E5B88FULL, -369, -92},
+          {0xF8A95FCF88747D94ULL, -343, -84},
+          {0xB94470938FA89BCFULL, -316, -76},
+          {0x8A08F0F8BF0F156BULL, -289, -68},
+          {0xCDB02555653131B6ULL, -263, -60},
+          {0x993FE2C6D07B7FACULL, -236, -52},
+          {0xE45C10C42A2B3B06ULL, -210, -44},
+          {0xAA242499697392D3ULL, -183, -36},
+          {0xFD87B5F28300CA0EULL, -157, -28},
+          {0xBCE5086492111AEBULL, -130, -20},
+          {0x8CBCCC096F5088CCULL, -103, -12},
+          {0xD1B71758E219652CULL, -77, -4},
+          {0x9C40000000000000ULL, -50, 4},
+          {0xE8D4A51000000000ULL, -24, 12},
+          {0xAD78EBC5AC620000ULL, 3, 20},
+          {0x813F3978F8940984ULL, 30, 28},
+          {0xC097CE7BC90715B3ULL, 56, 36},
+          {0x8F7E32CE7BEA5C70ULL, 83, 44},
+          {0xD5D238A4ABE98068ULL, 109, 52},
+          {0x9F4F2726179A2245ULL, 136, 60},
+          {0xED63A231D4C4FB27ULL, 162, 68},
+          {0xB0DE65388CC8ADA8ULL, 189, 76},
+          {0x83C7088E1AAB65DBULL, 216, 84},
+          {0xC45D1DF942711D9AULL, 242, 92},
+          {0x924D692CA61BE758ULL, 269, 100},
+          {0xDA01EE641A708DEAULL, 295, 108},
+          {0xA26DA3999AEF774AULL, 322, 116},
+          {0xF209787BB47D6B85ULL, 348, 124},
+          {0xB454E4A179DD1877ULL, 375, 132},
+          {0x865B86925B9BC5C2ULL, 402, 140},
+          {0xC83553C5C8965D3DULL, 428, 148},
+          {0x952AB45CFA97A0B3ULL, 455, 156},
+          {0xDE469FBD99A05FE3ULL, 481, 164},
+          {0xA59BC234DB398C25ULL, 508, 172},
+          {0xF6C69A72A3989F5CULL, 534, 180},
+          {0xB7DCBF5354E9BECEULL, 561, 188},
+          {0x88FCF317F22241E2ULL, 588, 196},
+          {0xCC20CE9BD35C78A5ULL, 614, 204},
+          {0x98165AF37B2153DFULL, 641, 212},
+          {0xE2A0B5DC971F303AULL, 667, 220},
+          {0xA8D9D1535CE3B396ULL, 694, 228},
+          {0xFB9B7CD9A4A7443CULL, 720, 236},
+          {0xBB764C4CA7A44410ULL, 747, 244},
+          {0x8BAB8EEFB6409C1AULL, 774, 252},
+          {0xD01FEF10A657842CULL, 800, 260},
+          {0x9B10A4E5E9913129ULL, 827, 268},
+          {0xE7109BFBA19C0C9DULL, 853, 276},
+          {0xAC2820D9623BF429ULL, 880, 284},
+          {0x80444B5E7AA7CF85ULL, 907, 292},
+          {0xBF21E44003ACDD2DULL, 933, 300},
+          {0x8E679C2F5E44FF8FULL, 960, 308},
+          {0xD433179D9C8CB841ULL, 986, 316},
+          {0x9E19DB92B4E31BA9ULL, 1013, 324}
+        };
+        constexpr int MinDecExp = -300, DecStep = 8;
+        const int f = Alpha - e - 1;
+        const int k = (f*78913)/(1 << 18) + (f > 0); // ceil(f*log10(2))
+        return Powers[(-MinDecExp + k + (DecStep - 1))/DecStep];
+      } // GetCachedPower
+
+      /// @return number of digits of n, Pow10 is 10^(digits - 1)
+      inline int LargestPow10(uint32_t n, uint32_t &Pow10) {
+        int k = 1;
+        for(Pow10 = 1; Pow10 <= n/10; Pow10 *= 10) ++k;
+        return k;
+      } // LargestPow10
+
+      /// moves the last digit closer to exact value while it stays in the rounding interval
+      inline void Round(char *Buf, int Len, uint64_t Dist, uint64_t Delta, uint64_t Rest, uint64_t TenK) {
+        while(Rest < Dist && Delta - Rest >= TenK && (Rest + TenK < Dist || Dist - Rest > Rest + TenK - Dist)) {
+          --Buf[Len - 1];
+          Rest += TenK;
+        }
+      } // Round
+
+      /// generates digits of number in (M_minus, M_plus) which is closest to w
+      /// @param[in,out] DecExp - value is Buf * 10^DecExp
+      inline int GenDigits(char *Buf, int &DecExp, DiyFp Minus, DiyFp w, DiyFp Plus) {
+        uint64_t Delta = DiyFp::Sub(Plus, Minus).f, Dist = DiyFp::Sub(Plus, w).f;
+        const int Shift = -Plus.e;
+        const uint64_t One = uint64_t(1) << Shift;
+        uint32_t p1 = uint32_t(Plus.f >> Shift); // integral part
+        uint64_t p2 = Plus.f & (One - 1); // fractional part
+        int Len = 0;
+
+        uint32_t Pow10;
+        for(int n = LargestPow10(p1, Pow10); n > 0; --n, Pow10 /= 10) {
+          Buf[Len++] = char('0' + p1/Pow10);
+          p1 %= Pow10;
+          const uint64_t Rest = (uint64_t(p1) << Shift) + p2;
+          if(Rest <= Delta) {
+            DecExp += n - 1;
+            Round(Buf, Len, Dist, Delta, Rest, uint64_t(Pow10) << Shift);
+            return Len;
+          }
+        }
+        int m = 0;
+        do {
+          p2 *= 10;
+          Buf[Len++] = char('0' + (p2 >> Shift));
+          p2 &= One - 1;
+          ++m;
+          Delta *= 10;
+          Dist *= 10;
+        } while(p2 > Delta);
+        DecExp -= m;
+        Round(Buf, Len, Dist, Delta, p2, One);
+        return Len;
+      } // GenDigits
+
+      /// @return number of digits in Buf, value is Buf * 10^DecExp
+      template<typename F>
+      int Digits(F Value, char *Buf, int &DecExp) {
+        const Boundaries b = GetBoundaries(Value);
+        const CachedPower c = GetCachedPower(b.Plus.e);
+        const DiyFp c_k{c.f, c.e};
+        const DiyFp w = DiyFp::Mul(b.w, c_k), Minus = DiyFp::Mul(b.Minus, c_k), Plus = DiyFp::Mul(b.Plus, c_k);
+        DecExp = -c.k;
+        // interval is made a bit narrower to stay inside of real one despite rounding errors
+        return GenDigits(Buf, DecExp, DiyFp{Minus.f + 1, Minus.e}, w, DiyFp{Plus.f - 1, Plus.e});
+      } // Digits
+    } // namespace grisu
+
+    /**
+     * text which reads back to the same value, almost always the shortest one (see file doc). Fixed notation when
+     * decimal exponent is at least -4 and less than 7 (float) or 17 (double), exponential like 1.5e+20 otherwise,
+     * as %g does
+     * @param p - buffer of MAX_SHORTEST chars
+     */
+    template<typename F>
+    char *FloatToShortest(F Value, char *p) {
+      static_assert(std::is_floating_point_v<F>, "Floating point only!");
+      if constexpr(!std::is_same_v<F, float> && !std::is_same_v<F, double>)
+        return FloatToShortest(double(Value), p); // long double
+      else {
+        constexpr int MaxExp = sizeof(F) == sizeof(float)?7:17;
+        if(Value != Value) return (char *)memcpy(p, "nan", 3) + 3;
+        if(std::signbit(Value)) {
+          *p++ = '-';
+          Value = -Value;
+        }
+        if(Value == 0) {
+          *p = '0';
+          return p + 1;
+        }
+        if(Value > std::numeric_limits<F>::max()) return (char *)memcpy(p, "inf", 3) + 3;
+
+        int DecExp, Len = grisu::Digits(Value, p, DecExp);
+        const int n = Len + DecExp; // value is 0.digits * 10^n
+        if(Len <= n && n <= MaxExp) { // digits000
+          memset(p + Len, '0', n - Len);
+          return p + n;
+        }
+        if(0 < n && n <= MaxExp) { // dig.its
+          memmove(p + n + 1, p + n, Len - n);
+          p[n] = '.';
+          return p + Len + 1;
+        }
+        if(-4 < n && n <= 0) { // 0.000digits
+          memmove(p + 2 - n, p, Len);
+          p[0] = '0';
+          p[1] = '.';
+          memset(p + 2, '0', -n);
+          return p + 2 - n + Len;
+        }
+        if(Len > 1) { // d.igits
+          memmove(p + 2, p + 1, Len - 1);
+          p[1] = '.';
+          ++Len;
+        }
+        p += Len;
+        *p++ = 'e';
+        int Exp = n - 1;
+        if(Exp < 0) {
+          *p++ = '-';
+          Exp = -Exp;
+        } else *p++ = '+';
+        return UintToDec(uint64_t(Exp), p, 2);
+      }
+    } // FloatToShortest
+  } // namespace num_conv
+} // namespace avp
+
+#endif /* AVP_NUMCONV_HPP_INCLUDED */
@@ -1,7 +1,51 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief std::ostream on top of a single virtual Write function.
+
+  When BufferSize is given, output is collected in a put area and goes to Write in bulk when the area is full and on
+  flush (std::flush, std::endl), so `<<` of a number does not end up in a Write call per character. With Background == true put area
+  is doubled, a full half is handed to a writer thread and the stream goes on filling the other half.
+  @code
+    class MyStream: public avp::OutStream {
+      std::size_t Write(uint8_t *p, std::size_t s) override { return port_write(p, s); }
+     public:
+      MyStream(): OutStream(512, true) {}
+      ~MyStream() { close(); }
+    };
+  @endcode
+  @note with BufferSize derived class destructor has to call close(), so the rest of output is written and background
+  writer is stopped while Write is still there, the base destructor can not do it
+  @note BufferSize 0, AVP_OUTSTREAM_BUFFER_SIZE default, gives the old unbuffered behavior, nothing is held back
+  */
+
 #pragma once
 
+#include <stdint.h>
+#include <string.h>
 #include <ostream>
 #include <streambuf>
+#include <memory>
+#include "Error.h"
+
+#ifndef AVP_OUTSTREAM_BUFFER_SIZE
+#define AVP_OUTSTREAM_BUFFER_SIZE 0 ///< default put area, buffering is opt-in
+#endif
+
+/// background writer needs std::thread
+#ifndef AVP_OUTSTREAM_BACKGROUND
+# if defined(__linux__) || defined(_WIN32) || defined(__APPLE__)
+#  define AVP_OUTSTREAM_BACKGROUND 1
+# else
+#  define AVP_OUTSTREAM_BACKGROUND 0
+# endif
+#endif
+
+#if AVP_OUTSTREAM_BACKGROUND
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
 
 namespace avp {
   class OutStream : public std::ostream {
@@ -10,30 +54,150 @@ namespace avp {
 
     class Buffer : public std::streambuf {
       OutStream &owner;
+      const std::size_t Size; ///< of put area
+      std::unique_ptr<char[]> Data; ///< put area, two of them with background writer
+#if AVP_OUTSTREAM_BACKGROUND
+      std::thread Writer;
+      std::mutex Lock;
+      std::condition_variable Cond;
+      const char *pPending = nullptr; ///< half handed to writer, nullptr if writer is idle
+      std::size_t PendingSize = 0;
+      bool Stop = false;
+
+      void Run() {
+        std::unique_lock<std::mutex> L(Lock);
+        for(;;) {
+          Cond.wait(L, [this] { return pPending != nullptr || Stop; });
+          if(Stop) return;
+          L.unlock();
+          owner.Write((uint8_t *)pPending, PendingSize);
+          L.lock();
+          pPending = nullptr;
+          Cond.notify_all();
+        }
+      } // Run
+#endif
+
+      /// waits until background writer wrote everything handed to it
+      void Wait() {
+#if AVP_OUTSTREAM_BACKGROUND
+        if(!Writer.joinable()) return;
+        std::unique_lock<std::mutex> L(Lock);
+        Cond.wait(L, [this] { return pPending == nullptr; });
+#endif
+      } // Wait
+
+      /// writes put area out or hands it to background writer and switches to the other half
+      void Flush() {
+        const std::size_t n = pptr() - pbase();
+        if(n == 0) return;
+#if AVP_OUTSTREAM_BACKGROUND
+        if(Writer.joinable()) {
+          Wait();
+          {
+            std::lock_guard<std::mutex> L(Lock);
+            pPending = pbase();
+            PendingSize = n;
+          }
+          Cond.notify_all();
+          char *p = pbase() == Data.get()?Data.get() + Size:Data.get();
+          setp(p, p + Size);
+          return;
+        }
+#endif
+        owner.Write((uint8_t *)pbase(), n);
+        setp(pbase(), epptr());
+      } // Flush
 
     protected:
-      /// single-character write
+      /// put area is full or there is none
       virtual int_type overflow(int_type c) override {
-        if (c != EOF) {
+        Flush();
+        if(c == traits_type::eof()) return traits_type::not_eof(c);
+        if(Size == 0) {
           uint8_t ch = c;
-          // if (owner.Write(&ch, 1) == 0) return EOF; // NO, if we return EOF the ostream gets into error state, we should not do that
-          owner.Write(&ch, 1);
-          return ch;
-        } return 0;
+          owner.Write(&ch, 1); // if we return EOF the ostream gets into error state, we should not do that
+        } else {
+          *pptr() = traits_type::to_char_type(c);
+          pbump(1);
+        }
         return c;
       } // overflow
       /// bulk write
       virtual std::streamsize xsputn(const char *s, std::streamsize n) override {
-        // return n > 0 ? owner.Write((uint8_t *)s, static_cast<std::size_t>(n)) : 0; // // NO, if we return 0 the ostream gets into error state, we should not do that
-        owner.Write((uint8_t *)s, static_cast<std::size_t>(n));
+        if(n <= epptr() - pptr()) {
+          memcpy(pptr(), s, n);
+          pbump(int(n));
+          return n;
+        }
+        Flush();
+        if(std::size_t(n) < Size) {
+          memcpy(pptr(), s, n);
+          pbump(int(n));
+        } else { // does not fit anyway, goes directly, after what is handed to background writer
+          Wait();
+          // if we return less than n the ostream gets into error state, we should not do that
+          owner.Write((uint8_t *)s, static_cast<std::size_t>(n));
+        }
         return n;
-      }
+      } // xsputn
+      virtual int sync() override {
+        Flush();
+        return 0;
+      } // sync
 
     public:
-      Buffer(OutStream &owner_) : owner(owner_) {}
+      Buffer(OutStream &owner_, std::size_t Size_, bool Background) : owner(owner_), Size(Size_) {
+        (void)Background;
+        if(Size == 0) return;
+#if AVP_OUTSTREAM_BACKGROUND
+        if(Background) {
+          Data.reset(new char[2*Size]);
+          Writer = std::thread(&Buffer::Run, this);
+        } else
+#endif
+          Data.reset(new char[Size]);
+        setp(Data.get(), Data.get() + Size);
+      } // Buffer
+      ~Buffer() { // owner Write is gone already, so nothing can be written
+        AVP_ASSERT_WITH_EXPL(pptr() == pbase(), "Derived class destructor has to call close()!");
+#if AVP_OUTSTREAM_BACKGROUND
+        AVP_ASSERT_WITH_EXPL(!Writer.joinable(), "Derived class destructor has to call close()!");
+#endif
+        StopWriter();
+      } // ~Buffer
+
+      /// writes everything out and stops background writer
+      void Close() {
+        Flush();
+        Wait();
+        StopWriter();
+      } // Close
+
+      void StopWriter() {
+#if AVP_OUTSTREAM_BACKGROUND
+        if(Writer.joinable()) {
+          {
+            std::lock_guard<std::mutex> L(Lock);
+            Stop = true;
+          }
+          Cond.notify_all();
+          Writer.join();
+          setp(Data.get(), Data.get() + Size); // the rest is written directly
+        }
+#endif
+      } // StopWriter
     } Buffer; // class Buffer
   public:
-    OutStream() : std::ostream(&Buffer), Buffer(*this) {}
+    /**
+     * @param BufferSize - size of put area, 0 - every character goes to Write right away
+     * @param Background - full put areas are written by a thread, only if AVP_OUTSTREAM_BACKGROUND
+     */
+    explicit OutStream(std::size_t BufferSize = AVP_OUTSTREAM_BUFFER_SIZE, bool Background = false) :
+      std::ostream(&Buffer), Buffer(*this, BufferSize, Background) {}
     virtual bool is_open() { return true; }
+    /// writes the rest of output and stops background writer, has to be called by derived class destructor if
+    /// BufferSize is not 0
+    void close() { Buffer.Close(); }
   }; // class OutStream
 } // namespace avp
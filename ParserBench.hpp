@@ -0,0 +1,201 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief Host throughput benchmark and fuzz harness of command parsers (CommandChain, CommandTable).
+
+  Benchmark feeds a command stream into a parser the way avp::Protocol does - either byte by byte or by
+  ParseBlock - and reports bytes and commands per second. Stream may be synthetic (see CommandStream, which
+  can draw commands with Zipf distribution to see how CommandList move-to-front behaves with realistic mixes)
+  or RX traffic recorded by PortCapture.
+  @code
+    typedef avp::CommandChain<uint16_t> Parser;
+    Parser::AddCommand("SG", SetGain, 5); ...
+    avp::CommandStream<> S(Parser::GetMaxParamBytes());
+    S.Add("SG", 5); S.Add("UP", Parser::VAR_PARAM_NUM);
+    auto Stream = S.Generate(100000, 1.0);
+    avp::ParserBench<Parser>::Run(Stream, 10, true).Print();
+  @endcode
+  Fuzz target for libFuzzer (clang -fsanitize=fuzzer,address) is defined by
+  @code
+    AVP_PARSER_FUZZ_TARGET(Parser)
+  @endcode
+  in a translation unit where all commands are registered (e.g. by a static initializer). Every input is
+  parsed by all parser entry points, and parser is checked to get back to command boundary after Flush.
+  Host only.
+  */
+
+#pragma once
+
+#ifndef NO_STL
+
+/// @cond
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <chrono>
+/// @endcond
+#include "CommandParser.hpp"
+#include "PortCapture.hpp"
+#include "Error.hpp"
+
+namespace avp {
+  /**
+   * synthetic command stream generator
+   * @tparam Checksum - the same as parser's
+   */
+  template<class Checksum = SumChecksum>
+  class CommandStream {
+    struct Spec {
+      std::vector<uint8_t> ID;
+      uint8_t NumParamBytes; ///< CommandParser::VAR_PARAM_NUM - random size
+    }; // Spec
+    std::vector<Spec> Specs;
+    std::mt19937 Gen;
+    const uint8_t MaxParamBytes;
+   public:
+    /// @param MaxParamBytes_ - parser limit, including count byte, e.g. CommandChain::GetMaxParamBytes()
+    explicit CommandStream(uint8_t MaxParamBytes_ = UINT8_MAX, uint32_t Seed = 1): Gen(Seed), MaxParamBytes(MaxParamBytes_) {}
+
+    /// @param ID - command mnemonics (CommandChain) or single byte string with table index + 1 (CommandTable)
+    void Add(const char *ID, uint8_t NumParamBytes) {
+      Specs.push_back(Spec{std::vector<uint8_t>(ID, ID + strlen(ID)), NumParamBytes});
+    } // Add
+
+    /// adds a command with given parameter bytes (var count byte included if needed) to Out
+    static void Append(std::vector<uint8_t> *pOut, const uint8_t *ID, size_t IDSize, const uint8_t *Params, size_t Size) {
+      const size_t Start = pOut->size();
+      pOut->insert(pOut->end(), ID, ID + IDSize);
+      pOut->insert(pOut->end(), Params, Params + Size);
+      pOut->push_back(Checksum::Update(Checksum::Init, pOut->data() + Start, pOut->size() - Start));
+    } // Append
+
+    /**
+     * @param NumCommands - number of commands in stream
+     * @param ZipfS - Zipf distribution exponent of command choice, 0 - uniform. Commands added first are
+     *   the most frequent
+     */
+    std::vector<uint8_t> Generate(size_t NumCommands, double ZipfS = 0) {
+      AVP_ASSERT(!Specs.empty());
+      std::vector<double> Weights;
+      for(size_t i = 0; i < Specs.size(); ++i) Weights.push_back(1/std::pow(double(i + 1), ZipfS));
+      std::discrete_distribution<size_t> Pick(Weights.begin(), Weights.end());
+      std::uniform_int_distribution<int> Byte(0, UINT8_MAX), VarCount(0, MaxParamBytes - 1);
+
+      std::vector<uint8_t> Out, Params;
+      while(NumCommands--) {
+        const Spec &S = Specs[Pick(Gen)];
+        Params.clear();
+        if(S.NumParamBytes == CommandParser::VAR_PARAM_NUM) Params.push_back(uint8_t(VarCount(Gen)));
+        const size_t Size = S.NumParamBytes == CommandParser::VAR_PARAM_NUM?Params[0]:S.NumParamBytes;
+        for(size_t i = 0; i < Size; ++i) Params.push_back(uint8_t(Byte(Gen)));
+        Append(&Out, S.ID.data(), S.ID.size(), Params.data(), Params.size());
+      }
+      return Out;
+    } // Generate
+
+    /// @return all RX bytes of PortCapture file, empty if it can not be read
+    static std::vector<uint8_t> FromCapture(const char *FileName) {
+      std::vector<uint8_t> Out;
+      capture::Reader R;
+      capture::Record Rec;
+      if(R.Open(FileName))
+        while(R.Next(&Rec)) if(!Rec.IsTX) Out.insert(Out.end(), Rec.Data.begin(), Rec.Data.end());
+      return Out;
+    } // FromCapture
+  }; // CommandStream
+
+  /// drives Parser like Protocol::ProcessInput does, but with no Port
+  template<class Parser>
+  struct ParserDriver {
+    typedef typename Parser::ParseError_ ParseError_;
+
+    /// @return number of errors
+    static size_t Feed(const uint8_t *p, size_t Size, bool Block) {
+      size_t Errors = 0;
+      for(const uint8_t *const End = p + Size; p < End;) {
+        ParseError_ Res;
+        if(size_t Wanted = Parser::InPlaceSizeWanted()) {
+          if(Wanted > size_t(End - p)) Res = Parser::ParseByte(*(p++));
+          else {
+            Res = Parser::ParseInPlace(p);
+            p += Wanted;
+          }
+        } else if(Block) {
+          size_t Used;
+          Res = Parser::ParseBlock(p, End - p, &Used);
+          if(Used == 0) Res = Parser::ParseByte(*(p++));
+          else p += Used;
+        } else Res = Parser::ParseByte(*(p++));
+
+        if(Res == CommandParser::BATCH) while((Res = Parser::ExecuteBatchItem()) == CommandParser::NO_ERROR);
+        if(Res != CommandParser::NO_ERROR && Res != CommandParser::NOOP && Res != CommandParser::BATCH_END) {
+          ++Errors;
+          Parser::Flush();
+        }
+      }
+      return Errors;
+    } // Feed
+  }; // ParserDriver
+
+  template<class Parser>
+  struct ParserBench {
+    struct Stats {
+      uint64_t Bytes = 0, Commands = 0, Errors = 0;
+      double Seconds = 0;
+
+      double BytesPerSec() const { return Seconds > 0?Bytes/Seconds:0; }
+      double CommandsPerSec() const { return Seconds > 0?Commands/Seconds:0; }
+
+      void Print() const {
+        debug_printf("%llu bytes, %llu commands, %llu errors in %.3f s: %.0f bytes/s, %.0f commands/s\n",
+                     (unsigned long long)Bytes, (unsigned long long)Commands, (unsigned long long)Errors, Seconds,
+                     BytesPerSec(), CommandsPerSec());
+      } // Print
+    }; // Stats
+
+    /**
+     * @param Repeats - how many times stream is parsed
+     * @param Block - parse by ParseBlock, as Protocol does when RX data are continuous, rather than byte by byte
+     */
+    static Stats Run(const std::vector<uint8_t> &Stream, unsigned Repeats = 1, bool Block = true) {
+      Stats S;
+      Parser::Flush();
+      const uint32_t Count0 = Parser::Count;
+      const auto Start = std::chrono::steady_clock::now();
+      for(unsigned r = 0; r < Repeats; ++r) S.Errors += ParserDriver<Parser>::Feed(Stream.data(), Stream.size(), Block);
+      S.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+      S.Commands = uint32_t(Parser::Count - Count0);
+      S.Bytes = uint64_t(Stream.size())*Repeats;
+      return S;
+    } // Run
+  }; // ParserBench
+
+  /// fuzzing of parser entry points, see AVP_PARSER_FUZZ_TARGET
+  template<class Parser>
+  struct ParserFuzz {
+    static int One(const uint8_t *Data, size_t Size) {
+      // first input byte chooses how the rest is split into chunks, so chunk boundaries get fuzzed too
+      const uint8_t Mode = Size?Data[0]:0;
+      if(Size) { ++Data; --Size; }
+      for(bool Block: {false, true}) {
+        Parser::Flush();
+        const size_t Chunk = Mode?Mode:Size + 1;
+        for(size_t Off = 0; Off < Size; Off += Chunk)
+          ParserDriver<Parser>::Feed(Data + Off, Size - Off < Chunk?Size - Off:Chunk, Block);
+        Parser::Flush();
+        AVP_ASSERT_WITH_EXPL(Parser::ParseByte(0) == CommandParser::NOOP, "Parser did not get back to command boundary!");
+      }
+      return 0;
+    } // One
+  }; // ParserFuzz
+} // namespace avp
+
+/// defines libFuzzer entry point for Parser
+#define AVP_PARSER_FUZZ_TARGET(Parser) \
+  extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) { \
+    return avp::ParserFuzz<Parser>::One(Data, Size); \
+  }
+
+#endif // NO_STL
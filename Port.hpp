@@ -36,6 +36,7 @@
 #include "MyMath.hpp"
 #include "Error.hpp"
 #include "General.hpp"
+#include "MyTime.hpp"
 #include "CircBuffer.hpp"
 #include "CircBufferWithCont.hpp"
 
@@ -67,6 +68,8 @@ namespace avp {
   __PORT_TEMPLATE__ struct  Port: public HW_IO_ {
     struct BlockInfo;
     typedef void (* tReleaseFunc)();
+    /// tap function is called with every chunk received or handed to HW_IO_ for sending, see SetTap
+    typedef void (* tTapFunc)(bool IsTX, const uint8_t *p, size_t Size);
 
     struct BlockInfo {
       const uint8_t *Ptr;
@@ -76,6 +79,28 @@ namespace avp {
     static uint8_t RunningCS;
     static uint16_t BytesTransmitted;
   protected:
+    // *************** peer flow control. CreditGranted is written only by main context, CreditUsed only by
+    // HW_IO callbacks, so we do not need locks. Their difference is credit left (may get negative because
+    // a block is sent as a whole)
+    static volatile bool FlowControlOn;
+    static volatile uint32_t CreditGranted, CreditUsed;
+
+    static bool PeerAllowsTX() { return !FlowControlOn || int32_t(CreditGranted - CreditUsed) > 0; }
+    static void UseCredit(size_t Size) { if(FlowControlOn) CreditUsed += Size; }
+
+    static tTapFunc pTap;
+
+    /// called by HW_IO callbacks for every chunk they hand out for sending
+    static void Sent(const uint8_t *p, size_t Size) {
+      UseCredit(Size);
+      if(pTap != nullptr) (*pTap)(true, p, Size);
+    } // Sent
+
+    static uint8_t TX_BatchDepth; //!< > 0 while TX batch is open, we do not kick HW_IO_ until it is committed
+
+    /// lets HW_IO_ know there are new data to send unless we are inside a TX batch
+    static void KickTX() { if(TX_BatchDepth == 0) HW_IO_::TryToSend(); }
+
     static CircBufferPWR2<uint8_t, Log2_TX_Buf_size, tSize> BufferTX; // byte transmit buffer
 
     // ***************  data for unbuffered block transmit buffer
@@ -91,6 +116,7 @@ namespace avp {
     static bool StoreReceivedByte(uint8_t b) {
       if(!BufferRX.LeftToWrite()) return false;
       BufferRX.Write(b);
+      if(pTap != nullptr) (*pTap)(false, &b, 1);
       return true;
     } // StoreReceivedByte
 
@@ -101,6 +127,7 @@ namespace avp {
     /// @param[out] p - pointer supplied by HW_IO to write the byte to
     static bool GetByteToSend(uint8_t *p) {
       // debug_action();
+      if(!PeerAllowsTX()) return false; // peer throttled us
 
       if(pCurByteInBlock != nullptr) { //  we are reading from block currently
         const BlockInfo *pCurBlock = BlockInfoBufTX.GetSlotToRead();
@@ -111,6 +138,7 @@ namespace avp {
           pCurByteInBlock = nullptr;
         } else {
           *p = *pCurByteInBlock; // send next byte from the block
+          Sent(pCurByteInBlock, 1);
           return true;
         }
       }
@@ -128,6 +156,7 @@ namespace avp {
           } else *p = *(pCurByteInBlock = BlockInfoBufTX.GetSlotToRead()->Ptr); // start sending block
         }
       }
+      Sent(p, 1);
       return true;
     } //  GetByteToSend
 
@@ -153,7 +182,7 @@ namespace avp {
         LastSentIsBlock = false;
       }
 
-      if(!BufferTX.LeftToRead()) {
+      if(!BufferTX.LeftToRead() || !PeerAllowsTX()) {
         *pp = nullptr;
         *pSz = 0;
         return false;
@@ -178,6 +207,7 @@ namespace avp {
           }
         }
       }
+      Sent(*pp, *pSz);
       return true;
     } //  GetBlockToSend
 
@@ -230,7 +260,7 @@ namespace avp {
         return false;
       }
       bool Res = write_byte_(d);
-      HW_IO_::TryToSend(); // got something to transmit, reenable interrupt
+      KickTX(); // got something to transmit, reenable interrupt
       return Res;
     } // write_byte
 
@@ -246,7 +276,7 @@ namespace avp {
         else
           while(Size--) if(!write_byte_(*(Ptr++))) return false;
       }
-      HW_IO_::TryToSend(); // got something to transmit, reenable interrupt
+      KickTX(); // got something to transmit, reenable interrupt
       return Out;
     }  // write
 
@@ -265,7 +295,7 @@ namespace avp {
       if(Size == 0) return true;
       if(!BufferTX.LeftToWrite()) return false;
       bool Res = write_unbuffered_(Ptr,Size,pReleaseFunc);
-      HW_IO_::TryToSend();
+      KickTX();
       return Res;
     } // write_unbuffered
 
@@ -276,6 +306,82 @@ namespace avp {
 
     //! @}
 
+    /// @{
+    /// TX transaction. Writes between BeginTX and CommitTX do not call HW_IO_::TryToSend, CommitTX of
+    /// the outermost transaction kicks it once, so a multi-part message rings the hardware once.
+    /// Transactions may be nested. Writes which find TX buffer full still kick HW_IO_ to free space.
+    static void BeginTX() { ++TX_BatchDepth; }
+    static void CommitTX() { if(--TX_BatchDepth == 0) HW_IO_::TryToSend(); }
+
+    /// scoped TX transaction
+    struct TX_Batch {
+      TX_Batch() { BeginTX(); }
+      ~TX_Batch() { CommitTX(); }
+    }; // TX_Batch
+    /// @}
+
+    // *************** TX SPACE AND BACK-PRESSURE ********************
+    /// @{
+    /// Writers which can not afford a failed write should check or wait for space first instead
+    /// of oversizing buffers
+    static constexpr size_t TX_Capacity() { return decltype(BufferTX)::GetCapacity(); }
+    static constexpr size_t TX_BlockCapacity() { return decltype(BlockInfoBufTX)::GetCapacity(); }
+    static size_t TX_SpaceLeft() { return BufferTX.LeftToWrite(); }
+    static size_t TX_BlocksLeft() { return BlockInfoBufTX.LeftToWrite(); }
+
+    /// @param Bytes - number of bytes going to BufferTX. Every unbuffered block takes one byte there as well
+    /// @param Blocks - number of unbuffered blocks
+    static bool HasTX_Space(size_t Bytes, size_t Blocks = 0) {
+      return Bytes <= TX_SpaceLeft() && Blocks <= TX_BlocksLeft();
+    } // HasTX_Space
+
+    /// number of block slots buffered write of these bytes takes, every byte equal to ESC_code goes as a fake block
+    static size_t TX_EscapedBlocks(const uint8_t *p, size_t Size) {
+      size_t n = 0;
+      while(Size--) n += *(p++) == ESC_code;
+      return n;
+    } // TX_EscapedBlocks
+
+    /**
+     * waits until there is space to write, kicking transmitter and calling loop_func while waiting
+     * @param Timeout - in TickFunction units
+     * @param loop_func - cooperative yield function, may be nullptr
+     * @return false if timed out or request is larger than buffer capacity, so waiting is pointless
+     */
+    template<Time_t (*TickFunction)() = millis>
+    static bool WaitForTX_Space(size_t Bytes, size_t Blocks, Time_t Timeout, void (*loop_func)() = nullptr) {
+      if(Bytes > TX_Capacity() || Blocks > TX_BlockCapacity()) return false;
+      TimeOut<TickFunction> T(Timeout);
+      while(!HasTX_Space(Bytes, Blocks)) {
+        HW_IO_::TryToSend(); // transmitter may have stopped
+        if(loop_func != nullptr) loop_func();
+        if(T) return false;
+      }
+      return true;
+    } // WaitForTX_Space
+    /// @}
+
+    /// @{
+    /// Peer flow control. Credit scheme: peer grants us bytes we may send, we stop transmitting
+    /// when credit is used up. XON/XOFF is its degenerate case - ResumeTX switches flow control off,
+    /// PauseTX switches it on with zero credit. Data keep on being buffered while we are throttled,
+    /// so writers see back-pressure through TX_SpaceLeft.
+    static void EnableFlowControl(uint32_t InitialCredit = 0) {
+      CreditGranted = CreditUsed + InitialCredit;
+      FlowControlOn = true;
+    } // EnableFlowControl
+    static void DisableFlowControl() { FlowControlOn = false; HW_IO_::TryToSend(); }
+    /// turns credit flow control on if it is off
+    static void GrantCredit(uint32_t Bytes) {
+      if(FlowControlOn) CreditGranted += Bytes;
+      else EnableFlowControl(Bytes);
+      HW_IO_::TryToSend();
+    } // GrantCredit
+    static void PauseTX() { EnableFlowControl(0); }  ///< XOFF
+    static void ResumeTX() { DisableFlowControl(); } ///< XON
+    static bool IsThrottled() { return !PeerAllowsTX(); }
+    /// @}
+
     static uint8_t GetRCS() {
       return RunningCS;  ///< get current running checksum
     }
@@ -309,6 +415,39 @@ namespace avp {
 
     static void FinishedReadingRX() { BufferRX.FinishedReading(); }
 
+    /// @{
+    /// in place reading of received bytes, to avoid copying bulk data
+    /// @return pointer to Size received bytes if they are continuous in RX buffer, nullptr otherwise
+    /// @param[out] pWait - set to true if the bytes have not arrived yet, but will be continuous, so it
+    ///   makes sense to wait for them
+    static const uint8_t *PeekRX(size_t Size, bool *pWait) {
+      *pWait = false;
+      if(BufferRX.ContinuousToRead() >= Size) return BufferRX.Peek();
+      *pWait = Size <= BufferRX.ContinuousSpace();
+      return nullptr;
+    } // PeekRX
+    /// @return pointer to all received bytes continuous in RX buffer, nullptr if there are none
+    /// @param[out] pSize - their number
+    static const uint8_t *PeekRX(size_t *pSize) {
+      *pSize = BufferRX.ContinuousToRead();
+      return *pSize?BufferRX.Peek():nullptr;
+    } // PeekRX
+    /// releases bytes read via PeekRX
+    static void SkipRX(size_t Size) { BufferRX.Skip(Size); }
+    /// @}
+
+    /// pushes bytes into RX buffer as if HW_IO_ received them, for loopbacks and traffic replay
+    /// @return number of bytes which fit
+    static size_t FeedRX(const uint8_t *p, size_t Size) {
+      size_t Fed = 0;
+      while(Fed < Size && StoreReceivedByte(p[Fed])) ++Fed;
+      return Fed;
+    } // FeedRX
+
+    /// installs traffic tap (e.g. PortCapture::Tap), nullptr removes it
+    /// @note tap is called from HW_IO_ callbacks, so it is likely called from interrupts
+    static void SetTap(tTapFunc pTap_) { pTap = pTap_; }
+
     /*
     * this function does not check if buffer is empty and the return is undefined
     * @note !!!!! ALWAYS CHECK "SomethingToRX" FIRST
@@ -347,6 +486,11 @@ namespace avp {
   _TEMPLATE_DECL_ CircBufferWithCont<uint8_t, Log2_RX_Buf_Size, tSize> _TEMPLATE_SPEC_::BufferRX;
   _TEMPLATE_DECL_ uint8_t _TEMPLATE_SPEC_::RunningCS;
   _TEMPLATE_DECL_ uint16_t _TEMPLATE_SPEC_::BytesTransmitted = 0;
+  _TEMPLATE_DECL_ uint8_t _TEMPLATE_SPEC_::TX_BatchDepth = 0;
+  _TEMPLATE_DECL_ typename _TEMPLATE_SPEC_::tTapFunc _TEMPLATE_SPEC_::pTap = nullptr;
+  _TEMPLATE_DECL_ volatile bool _TEMPLATE_SPEC_::FlowControlOn = false;
+  _TEMPLATE_DECL_ volatile uint32_t _TEMPLATE_SPEC_::CreditGranted = 0;
+  _TEMPLATE_DECL_ volatile uint32_t _TEMPLATE_SPEC_::CreditUsed = 0;
 
   /**
     @tparam HW_IO_: see "Port" description
@@ -0,0 +1,353 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief Recording of Port traffic into a capture file and its replay into avp::Protocol.
+  Host only (uses stdio files, std::mutex and std::atomic).
+
+  Capture file format, all multibyte values are little endian:
+    - header: 8 bytes magic "AVPCAP\0" + format version byte
+    - records, one per chunk of traffic in one direction:
+      + uint8_t flags, bit 0 is set for TX, clear for RX
+      + varint time in microseconds since previous record (since capture start for the first one)
+      + varint chunk size
+      + chunk bytes
+    .
+  varint is LEB128 - 7 bits per byte, lowest first, bit 7 set if more bytes follow.
+  Consecutive bytes going in the same direction are coalesced into a single chunk while they
+  come within CoalesceTime of chunk start, so byte-by-byte HW_IO does not bloat the file.
+  Tap is called from HW_IO callbacks, so it only copies bytes into a lock-free queue, Service called from main
+  loop writes them into the file.
+
+  Usage:
+  @code
+    avp::PortCapture<>::Open("traffic.cap");
+    MyPort::SetTap(avp::PortCapture<>::Tap);
+    ...
+    avp::PortCapture<>::Service(); // in main loop
+    ...
+    avp::PortCapture<>::Close();
+    ...
+    auto Stats = avp::ProtocolReplay<MyProtocol>::Run("traffic.cap", false);
+    Stats.Print();
+  @endcode
+  */
+
+#pragma once
+
+#ifndef NO_STL
+
+/// @cond
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <atomic>
+#include <vector>
+/// @endcond
+#include "millis_micros.hpp"
+#include "General.hpp"
+#include "MyMath.hpp"
+#include "Error.h"
+
+namespace avp {
+  namespace capture {
+    static constexpr uint8_t Magic[] = {'A', 'V', 'P', 'C', 'A', 'P', 0, 1}; ///< last byte is format version
+    enum Flags_ {TX = 1};
+
+    inline void write_varint(FILE *f, uint32_t x) {
+      while(x >= 0x80) {
+        fputc(int(x & 0x7F) | 0x80, f);
+        x >>= 7;
+      }
+      fputc(int(x), f);
+    } // write_varint
+
+    inline bool read_varint(FILE *f, uint32_t *px) {
+      *px = 0;
+      for(uint8_t Shift = 0; Shift < 35; Shift += 7) {
+        int c = fgetc(f);
+        if(c == EOF) return false;
+        *px |= uint32_t(c & 0x7F) << Shift;
+        if(!(c & 0x80)) return true;
+      }
+      return false; // too long, file is corrupted
+    } // read_varint
+
+    struct Record {
+      bool IsTX;
+      uint32_t Time; ///< microseconds since capture start
+      std::vector<uint8_t> Data;
+    }; // Record
+
+    /// sequential reader of capture files
+    class Reader {
+      FILE *f = nullptr;
+      uint32_t Time = 0;
+     public:
+      ~Reader() { Close(); }
+
+      bool Open(const char *FileName) {
+        Close();
+        if((f = fopen(FileName, "rb")) == nullptr) return false;
+        uint8_t Header[sizeof(Magic)];
+        if(fread(Header, 1, sizeof(Header), f) != sizeof(Header) || memcmp(Header, Magic, sizeof(Magic)) != 0) {
+          Close();
+          return false;
+        }
+        Time = 0;
+        return true;
+      } // Open
+
+      void Close() {
+        if(f != nullptr) fclose(f);
+        f = nullptr;
+      } // Close
+
+      /// @return false at the end of file or if it is corrupted
+      bool Next(Record *pRec) {
+        if(f == nullptr) return false;
+        int Flags = fgetc(f);
+        uint32_t Delta, Size;
+        if(Flags == EOF || !read_varint(f, &Delta) || !read_varint(f, &Size)) return false;
+        pRec->IsTX = Flags & TX;
+        pRec->Time = (Time += Delta);
+        pRec->Data.resize(Size);
+        return fread(pRec->Data.data(), 1, Size, f) == Size;
+      } // Next
+    }; // Reader
+  } // namespace capture
+
+  /**
+   * static class recording traffic going through Port into a capture file. Tap function is installed
+   * by Port::SetTap
+   * @tparam CoalesceTime - microseconds, bytes in the same direction coming within this time from chunk
+   *    start go into the same record
+   * @tparam MaxChunk - maximum record size
+   * @tparam Log2QueueSize - log2 of size of the queue between Tap and Service. Bytes which do not fit are
+   *    dropped and counted, see GetDropped
+   */
+  template<uint32_t CoalesceTime = 1000, uint32_t MaxChunk = 1024, uint8_t Log2QueueSize = 14>
+  class PortCapture {
+    static constexpr uint32_t QueueSize = uint32_t(1) << Log2QueueSize, QueueMask = QueueSize - 1;
+
+    /// queue entry header, tapped bytes follow
+    struct Entry {
+      uint8_t Committed; ///< 0 until entry is complete, queue is zeroed after reading
+      uint8_t IsTX;
+      uint16_t Size;
+      uint32_t Time;
+    }; // Entry
+    static constexpr size_t MaxEntry = QueueSize/4 < UINT16_MAX?QueueSize/4:UINT16_MAX; ///< bytes, larger taps are split
+    static_assert(MaxEntry > sizeof(Entry), "Queue is too small!");
+
+    static inline std::mutex Lock; ///< file and chunk, Tap does not take it
+    static inline FILE *f = nullptr;
+    static inline uint32_t LastRecordTime;
+    static inline bool ChunkIsTX;
+    static inline uint32_t ChunkTime;
+    static inline std::vector<uint8_t> Chunk;
+
+    // queue, many producers (Tap may be called from RX and TX callbacks), single consumer (Service under Lock)
+    static inline uint8_t Queue[QueueSize];
+    static inline std::atomic<uint32_t> Reserved{0}, Tail{0}; ///< free running
+    static inline std::atomic<uint32_t> Dropped{0};
+    static inline std::atomic<bool> Enabled{false};
+
+    static void Put(uint32_t Pos, const void *p, size_t n) {
+      const uint32_t Start = Pos & QueueMask, First = QueueSize - Start;
+      if(n <= First) memcpy(Queue + Start, p, n);
+      else {
+        memcpy(Queue + Start, p, First);
+        memcpy(Queue, (const uint8_t *)p + First, n - First);
+      }
+    } // Put
+    static void Get(uint32_t Pos, void *p, size_t n) {
+      const uint32_t Start = Pos & QueueMask, First = QueueSize - Start;
+      if(n <= First) memcpy(p, Queue + Start, n);
+      else {
+        memcpy(p, Queue + Start, First);
+        memcpy((uint8_t *)p + First, Queue, n - First);
+      }
+    } // Get
+    static void Zero(uint32_t Pos, size_t n) {
+      const uint32_t Start = Pos & QueueMask, First = QueueSize - Start;
+      if(n <= First) memset(Queue + Start, 0, n);
+      else {
+        memset(Queue + Start, 0, First);
+        memset(Queue, 0, n - First);
+      }
+    } // Zero
+
+    static void WriteChunk() {
+      if(Chunk.empty()) return;
+      fputc(ChunkIsTX?capture::TX:0, f);
+      capture::write_varint(f, ChunkTime - LastRecordTime);
+      capture::write_varint(f, Chunk.size());
+      fwrite(Chunk.data(), 1, Chunk.size(), f);
+      LastRecordTime = ChunkTime;
+      Chunk.clear();
+    } // WriteChunk
+
+    /// adds Size queued bytes starting at Pos to chunks
+    static void AddToChunk(bool IsTX, uint32_t Time, uint32_t Pos, size_t Size) {
+      while(Size) {
+        if(!Chunk.empty() && (IsTX != ChunkIsTX || Chunk.size() == MaxChunk || Time - ChunkTime > CoalesceTime))
+          WriteChunk();
+        if(Chunk.empty()) {
+          ChunkIsTX = IsTX;
+          ChunkTime = Time;
+        }
+        const size_t n = min<size_t>(Size, MaxChunk - Chunk.size()), Old = Chunk.size();
+        Chunk.resize(Old + n);
+        Get(Pos, Chunk.data() + Old, n);
+        Pos += n;
+        Size -= n;
+      }
+    } // AddToChunk
+
+    /// moves committed queue entries into chunks, Lock should be held. Entries are dropped if file is closed
+    static void Drain() {
+      uint32_t T = Tail.load(std::memory_order_relaxed);
+      while(T != Reserved.load(std::memory_order_acquire) && __atomic_load_n(&Queue[T & QueueMask], __ATOMIC_ACQUIRE)) {
+        Entry E;
+        Get(T, &E, sizeof(E));
+        if(f != nullptr) AddToChunk(E.IsTX, E.Time, T + sizeof(E), E.Size);
+        Zero(T, sizeof(E) + E.Size); // so stale bytes never look committed
+        Tail.store(T += sizeof(E) + E.Size, std::memory_order_release);
+      }
+    } // Drain
+   public:
+    static bool Open(const char *FileName) {
+      std::lock_guard<std::mutex> Guard(Lock);
+      Enabled.store(false, std::memory_order_relaxed);
+      if(f != nullptr) fclose(f);
+      f = nullptr;
+      Drain(); // leftovers of previous capture
+      if((f = fopen(FileName, "wb")) == nullptr) return false;
+      fwrite(capture::Magic, 1, sizeof(capture::Magic), f);
+      LastRecordTime = micros();
+      Chunk.clear();
+      Chunk.reserve(MaxChunk);
+      Dropped.store(0, std::memory_order_relaxed);
+      Enabled.store(true, std::memory_order_release);
+      return true;
+    } // Open
+
+    /// writes queued traffic into the file, should be called from main loop
+    static void Service() {
+      std::lock_guard<std::mutex> Guard(Lock);
+      Drain();
+    } // Service
+
+    /// writes queued traffic and accumulated chunk out
+    static void Flush() {
+      std::lock_guard<std::mutex> Guard(Lock);
+      if(f == nullptr) return;
+      Drain();
+      WriteChunk();
+      fflush(f);
+    } // Flush
+
+    static void Close() {
+      std::lock_guard<std::mutex> Guard(Lock);
+      Enabled.store(false, std::memory_order_relaxed);
+      if(f == nullptr) return;
+      Drain();
+      WriteChunk();
+      fclose(f);
+      f = nullptr;
+    } // Close
+
+    /// number of bytes tapped while queue was full, they are missing in capture file
+    static uint32_t GetDropped() { return Dropped.load(std::memory_order_relaxed); }
+
+    /// Port::tTapFunc, may be called from interrupts or HW_IO threads, it does not lock or do file I/O
+    static void Tap(bool IsTX, const uint8_t *p, size_t Size) {
+      if(!Enabled.load(std::memory_order_acquire)) return;
+      const uint32_t Now = micros();
+      while(Size) {
+        const size_t n = Size < MaxEntry?Size:MaxEntry;
+        uint32_t Pos = Reserved.load(std::memory_order_relaxed);
+        do {
+          if(Pos + sizeof(Entry) + n - Tail.load(std::memory_order_acquire) > QueueSize) {
+            Dropped.fetch_add(uint32_t(Size), std::memory_order_relaxed);
+            return;
+          }
+        } while(!Reserved.compare_exchange_weak(Pos, Pos + uint32_t(sizeof(Entry) + n), std::memory_order_acq_rel,
+                                                std::memory_order_relaxed));
+        const Entry E = {0, IsTX, uint16_t(n), Now};
+        Put(Pos + 1, (const uint8_t *)&E + 1, sizeof(E) - 1);
+        Put(Pos + sizeof(E), p, n);
+        __atomic_store_n(&Queue[Pos & QueueMask], uint8_t(1), __ATOMIC_RELEASE);
+        p += n;
+        Size -= n;
+      }
+    } // Tap
+  }; // PortCapture
+
+  /**
+   * feeds RX records of a capture file into Protocol_ and measures how fast it processes them.
+   * TX records are skipped, output Protocol_ generates goes to its HW_IO, which should just discard it
+   * @tparam Protocol_ - avp::Protocol specialization
+   */
+  template<class Protocol_>
+  struct ProtocolReplay {
+    struct Stats {
+      uint32_t Chunks = 0, RX_Bytes = 0, TX_Bytes = 0; // TX_Bytes is recorded, not generated
+      uint32_t Commands = 0;
+      uint32_t Elapsed = 0; ///< us, whole replay
+      uint32_t Busy = 0; ///< us, time spent processing chunks, excluding waiting in real time mode
+      uint32_t MaxLatency = 0; ///< us, longest time from chunk arrival to all its bytes processed
+
+      double CommandsPerSec() const { return Busy?Commands*1e6/Busy:0; }
+      double BytesPerSec() const { return Busy?RX_Bytes*1e6/Busy:0; }
+      double MeanLatency() const { return Chunks?double(Busy)/Chunks:0; }
+
+      void Print() const {
+        debug_printf("Replayed %lu chunks, %lu RX bytes, %lu commands in %lu us\n"
+                     "%.0f commands/s, %.0f bytes/s, latency mean %.1f us, max %lu us\n",
+                     (unsigned long)Chunks, (unsigned long)RX_Bytes, (unsigned long)Commands, (unsigned long)Elapsed,
+                     CommandsPerSec(), BytesPerSec(), MeanLatency(), (unsigned long)MaxLatency);
+      } // Print
+    }; // Stats
+
+    /**
+     * @param RealTime - if true chunks are fed at recorded times, Protocol_::cycle is called while waiting.
+     * Otherwise they are fed as fast as possible
+     */
+    static Stats Run(const char *FileName, bool RealTime = false) {
+      Stats S;
+      capture::Reader R;
+      if(!R.Open(FileName)) {
+        debug_printf("ProtocolReplay: can not open capture file %s!\n", FileName);
+        return S;
+      }
+      capture::Record Rec;
+      const uint32_t Count0 = Protocol_::Parser::Count, Start = micros();
+
+      while(R.Next(&Rec)) {
+        if(Rec.IsTX) {
+          S.TX_Bytes += Rec.Data.size();
+          continue;
+        }
+        if(RealTime) while(micros() - Start < Rec.Time) Protocol_::cycle();
+
+        const uint32_t ChunkStart = micros();
+        for(size_t Fed = 0; Fed < Rec.Data.size(); Protocol_::cycle()) // RX buffer may be smaller than chunk
+          Fed += Protocol_::FeedRX(Rec.Data.data() + Fed, Rec.Data.size() - Fed);
+        while(Protocol_::SomethingToRX()) Protocol_::cycle();
+        const uint32_t Latency = micros() - ChunkStart;
+
+        S.Busy += Latency;
+        S.MaxLatency = max(S.MaxLatency, Latency);
+        S.RX_Bytes += Rec.Data.size();
+        ++S.Chunks;
+      }
+      S.Elapsed = micros() - Start;
+      S.Commands = Protocol_::Parser::Count - Count0;
+      return S;
+    } // Run
+  }; // ProtocolReplay
+} // namespace avp
+
+#endif // NO_STL
@@ -30,8 +30,32 @@
         Info message block may come at any time, but not inside another return block
       .
       If error or info message do not fit into 127 bytes remaining text is formatted into consecutive info message(s).
+    - many small commands may be sent in one batch frame, see \ref Batch "Batch frames".
     .
 
+  @section Batch Batch frames
+  Batch frames are disabled by default, they are enabled by defining AVP_COMMAND_BATCH_SIZE - maximum body size.
+  Batch frame (see avp::CommandBatch) is a byte 0xFF, uint16_t size of the body, the body - sub-commands in
+  usual format but without checksums - and a single checksum of all these bytes. Sub-commands are executed back
+  to back, and their returns are collected into a single successful return block. Its data are a record per
+  sub-command:
+    - int8_t CODE
+      + 0 - sub-command succeeded, followed by uint16_t Size and Size bytes of whatever it returned (may be none)
+      + -1 - sub-command is malformed or there was no space for more returns, so it and all following
+        sub-commands were not executed. It is always the last record
+      + -2 - sub-command was executed but its return did not fit into AVP_PROTOCOL_BATCH_RETURN_SIZE
+      + < -2 - sub-command failed, -CODE bytes of error message text follow
+    .
+  Error message text in a record is limited to 127 bytes, the rest goes out as info messages before the batch
+  return. Batch return block goes through the buffered TX path, so Port TX buffer should be able to hold
+  AVP_PROTOCOL_BATCH_RETURN_SIZE + 4 bytes, if it can not be sent an error message is returned instead.
+
+  @section Deferred Deferred commands
+  Slow command handlers may be executed by a worker instead of Protocol::cycle, see CommandQueue.hpp.
+  Their returns are sent by Protocol::cycle in command order. Deferred handler may return at most
+  ReturnSize bytes (CommandQueue template parameter) including block framing, otherwise an error message is
+  returned instead. Sub-commands of batch frames are never deferred.
+
   @section StartHandshake Initial Handshake.
   There may be several physical and virtual COM ports in the system, and we got to determine which
   one device is connected to. This class supports automatic port finding. It sends out BeaconStr
@@ -58,6 +82,20 @@
     - as soon communicating program receives the first four 0 bytes return it should stop sending NOOPs
     - communicating program should read out all 0 bytes until there are no more
     - when it happens the protocol is resynchronized.
+  On lossy links use avp::ReliablePort (ReliablePort.hpp) as Port - it retransmits lost frames itself, so
+  resynchronization is never needed.
+
+  @section FlowControl TX back-pressure and flow control
+  Return functions do not fail as soon as Port TX buffers are full. They reserve space first, waiting up to
+  avp::Protocol::TX_WaitTimeout milliseconds while calling avp::Protocol::YieldFunc. Return larger than the buffer
+  is streamed in chunks as space frees up. If the timeout expires the return is dropped: return function returns
+  false, avp::Protocol::DroppedReturns is incremented and an error block is sent in its place. If TX stalls in
+  the middle of a streamed return the block is truncated and the communicating program has to resynchronize.
+  The communicating program may throttle FW by a credit scheme: avp::Protocol::FlowControlCommand handler
+  (should be registered by user under a command ID of choice with 2 parameter bytes) takes uint16_t:
+    - 0 - XOFF, stop transmitting
+    - 0xFFFF - XON, flow control off, transmit freely
+    - any other value - grant this many more bytes to transmit, turns credit flow control on
 
   */
 
@@ -73,7 +111,14 @@
 #include "MyTime.hpp"
 #include "Port.hpp"
 #include "IO.hpp"
+#include "Format.hpp"
 #include "CommandParser.hpp"
+#include "CommandQueue.hpp"
+#include "CommandProfile.hpp"
+
+#ifndef AVP_PROTOCOL_BATCH_RETURN_SIZE
+#define AVP_PROTOCOL_BATCH_RETURN_SIZE AVP_COMMAND_BATCH_SIZE ///< maximum size of aggregated batch return data
+#endif
 
 namespace avp {
   /**
@@ -90,53 +135,239 @@ namespace avp {
     - should define Port::tReleaseFunc
     - bool SomethingToRX()
     - bool SomethingToTX()
+    - const uint8_t *PeekRX(size_t Size, bool *pWait), const uint8_t *PeekRX(size_t *pSize),
+      void SkipRX(size_t Size) - in place reading
 
   @tparam InputParser - class which provides ParseByte and Flush commands. Former parses input byte stream,
   finding commands and parameters and executing them and latter flushes it if something goes wrong.
+  InPlaceSizeWanted and ParseInPlace let it take bulk parameters right from Port RX buffer, ParseBlock
+  parses whatever is continuous there at once. ExecuteBatchItem executes sub-commands of batch frame.
   Subclass of CommandParser, currently either CommandChain or CommandTable
+  @tparam Queue - CommandQueue for deferred commands or NoCommandQueue
   */
-  template<class Port, class InputParser, uint16_t BeaconPeriod, void (*ConnectFunc)() = nullptr, void (*DropFunc)() = nullptr>
+  template<class Port, class InputParser, uint16_t BeaconPeriod, void (*ConnectFunc)() = nullptr, void (*DropFunc)() = nullptr,
+           class Queue = NoCommandQueue>
   class Protocol: public Port {
    protected:
     enum ErrorCodes_ {CS_ERROR = 1, UART_ERROR, NUM_ERR_CODES};
+    enum BatchItemCodes_ {NOT_EXECUTED = 1, RETURN_LOST, NUM_ITEM_CODES}; ///< see \ref Batch
+    static_assert(int(NUM_ITEM_CODES) == int(NUM_ERR_CODES), "Error message padding assumes the same number of codes!");
+
+#define RET_IF_FALSE(exp) do{if(!(exp)) return false;}while(0)
+
+    /// block slots buffered write of these bytes takes besides their space, see Port::TX_EscapedBlocks
+    static size_t EscBlocks(const void *p, size_t Size) { return Port::TX_EscapedBlocks((const uint8_t *)p, Size); }
+    template<typename T>
+    static size_t EscBlocks(const T &x) { return EscBlocks(&x, sizeof(x)); }
 
     static bool PortConnected;
     static const char *BeaconStr;
     static size_t BytesLeftToRead;
     static uint8_t *DestPtr;
 
+    /// returns of batch sub-commands are collected here, see \ref Batch
+    static struct BatchReturn_ {
+      uint8_t Data[AVP_PROTOCOL_BATCH_RETURN_SIZE + (AVP_PROTOCOL_BATCH_RETURN_SIZE == 0)];
+      uint16_t Size;
+      uint16_t ItemStart; ///< where record of current sub-command starts
+    } BatchRet;
+    static AVP_THREAD_LOCAL bool InBatch; ///< return functions append to current batch record instead of sending
+    static AVP_THREAD_LOCAL ReturnCapture *pCapture; ///< return functions write here instead of Port if set
+
+    /// write functions of return functions, they go either to Port or to pCapture
+    struct TX {
+      static bool write_byte(uint8_t d) {
+        AVP_COMMAND_RETURNED(1);
+        return pCapture != nullptr?pCapture->Append(&d, 1):Port::write_byte(d);
+      } // write_byte
+      static bool write_char(int8_t d) { return write_byte(uint8_t(d)); }
+      static bool write(const uint8_t *Ptr, size_t Size) {
+        AVP_COMMAND_RETURNED(Size);
+        return pCapture != nullptr?pCapture->Append(Ptr, Size):Port::write(Ptr, Size);
+      } // write
+      template<typename T>
+      static bool write(const T &x) { return write((const uint8_t *)&x, sizeof(x)); }
+      static bool write_unbuffered(const uint8_t *Ptr, size_t Size, typename Port::tReleaseFunc pReleaseFunc = nullptr) {
+        AVP_COMMAND_RETURNED(Size);
+        if(pCapture == nullptr) return Port::write_unbuffered(Ptr, Size, pReleaseFunc);
+        pCapture->Append(Ptr, Size); // copied, so may be released right away
+        if(pReleaseFunc != nullptr) pReleaseFunc();
+        return true;
+      } // write_unbuffered
+    }; // TX
+
+    /// TX transaction of return functions, see Port::TX_Batch. It is not opened when returns are captured,
+    /// because then they may be written by worker and do not touch Port anyway
+    struct ReturnBatch {
+      const bool Open = pCapture == nullptr;
+      ReturnBatch() { if(Open) Port::BeginTX(); }
+      ~ReturnBatch() { if(Open) Port::CommitTX(); }
+    }; // ReturnBatch
+
+    /// @return how many of these bytes buffered write may take right now, escape bytes take block slots
+    static size_t TX_Fits(const uint8_t *p, size_t Size) {
+      size_t n = Port::TX_SpaceLeft(), Blocks = Port::TX_BlocksLeft();
+      if(n > Size) n = Size;
+      for(size_t i = 0; i < n; ++i)
+        if(EscBlocks(p + i, 1) != 0 && Blocks-- == 0) return i;
+      return n;
+    } // TX_Fits
+
+    /// buffered write of return block which may be larger than Port TX buffers. It goes out in chunks as space
+    /// frees up, the way SendDeferredReturns does, waiting up to TX_WaitTimeout for every chunk. If space for the
+    /// whole block is reserved already it is a single write
+    static bool StreamTX(const uint8_t *p, size_t Size) {
+      if(pCapture != nullptr) return TX::write(p, Size);
+      while(Size != 0) {
+        const size_t n = TX_Fits(p, Size);
+        if(n == 0) RET_IF_FALSE(ReserveTX(1, EscBlocks(p, 1)));
+        else {
+          RET_IF_FALSE(TX::write(p, n));
+          p += n;
+          Size -= n;
+        }
+      }
+      return true;
+    } // StreamTX
+    template<typename T>
+    static bool StreamTX(const T &x) { return StreamTX((const uint8_t *)&x, sizeof(x)); }
+    static bool StreamTX_Unbuffered(const uint8_t *p, size_t Size, typename Port::tReleaseFunc pReleaseFunc) {
+      return ReserveTX(1, 1) && TX::write_unbuffered(p, Size, pReleaseFunc);
+    } // StreamTX_Unbuffered
+
+    /// reserves space for the whole return block, so it goes out at once. Block which can never fit into Port
+    /// TX buffers is not waited for, it is streamed by StreamTX
+    static bool ReserveReturn(size_t Bytes, size_t Blocks) {
+      if(Bytes > Port::TX_Capacity() || Blocks > Port::TX_BlockCapacity()) return true;
+      return ReserveTX(Bytes, Blocks);
+    } // ReserveReturn
+
+    /// called when return could not be sent because TX did not free up for TX_WaitTimeout, see \ref FlowControl
+    /// @param Truncated - part of return block is sent already, so error block can not follow
+    /// @return false, so return functions may just return it
+    static bool ReturnDropped(bool Truncated = false) {
+      if(pCapture != nullptr) return false; // capture overflow is reported when capture is sent
+      ++DroppedReturns;
+      debug_printf("Return %s, TX stalled for %lu ms!\n", Truncated?"truncated":"dropped", (unsigned long)TX_WaitTimeout);
+      if(!Truncated) return_error_str("Return dropped, TX stalled!\n");
+      return false;
+    } // ReturnDropped
+
+    /// appends sub-command return to its record
+    static bool BatchAppend(const uint8_t *Src, size_t Size) {
+      AVP_COMMAND_RETURNED(Size);
+      if constexpr(AVP_PROTOCOL_BATCH_RETURN_SIZE != 0) { // otherwise we are never InBatch
+        if(BatchRet.Data[BatchRet.ItemStart] != 0) return true; // record is an error already
+        if(BatchRet.Size + Size + 1 > sizeof(BatchRet.Data)) { // 1 byte is always left for NOT_EXECUTED record
+          BatchRet.Data[BatchRet.ItemStart] = uint8_t(-RETURN_LOST);
+          BatchRet.Size = BatchRet.ItemStart + 1;
+        } else {
+          memcpy(BatchRet.Data + BatchRet.Size, Src, Size);
+          BatchRet.Size += Size;
+        }
+      }
+      return true;
+    } // BatchAppend
+
+    /// replaces record of current sub-command with error message
+    static bool BatchError(const uint8_t *Src, uint8_t Size, uint8_t PadSize) {
+      if constexpr(AVP_PROTOCOL_BATCH_RETURN_SIZE != 0) { // otherwise we are never InBatch
+        BatchRet.Size = BatchRet.ItemStart;
+        if(size_t(BatchRet.Size) + 1 + Size + 1 > sizeof(BatchRet.Data)) {
+          BatchRet.Data[BatchRet.Size++] = uint8_t(-RETURN_LOST);
+          return true;
+        }
+        const size_t TextSize = size_t(Size - PadSize); // Size includes padding
+        BatchRet.Data[BatchRet.Size++] = uint8_t(-Size);
+        memcpy(BatchRet.Data + BatchRet.Size, Src, TextSize);
+        memset(BatchRet.Data + BatchRet.Size + TextSize, ' ', PadSize);
+        BatchRet.Size += Size;
+      }
+      return true;
+    } // BatchError
+
+    /// executes sub-commands of received batch frame and sends their returns in a single block
+    static void ExecuteBatch() {
+      static_assert(AVP_PROTOCOL_BATCH_RETURN_SIZE + 4 <= Port::TX_Capacity(),
+                    "Batch return does not fit into Port TX buffer, decrease AVP_PROTOCOL_BATCH_RETURN_SIZE!");
+      BatchRet.Size = 0;
+      InBatch = true;
+      for(;;) {
+        if(size_t(BatchRet.Size) + 4 > sizeof(BatchRet.Data)) { // no space for one more record, dropping the rest
+          BatchRet.Data[BatchRet.Size++] = uint8_t(-NOT_EXECUTED);
+          InputParser::Flush();
+          break;
+        }
+        BatchRet.ItemStart = BatchRet.Size;
+        BatchRet.Data[BatchRet.Size] = 0; // success until a handler says otherwise
+        BatchRet.Size += 3; // code and size
+        const typename InputParser::ParseError_ Res = InputParser::ExecuteBatchItem();
+        if(Res == InputParser::BATCH_END) {
+          BatchRet.Size = BatchRet.ItemStart;
+          break;
+        }
+        if(Res != InputParser::NO_ERROR) {
+          BatchRet.Data[BatchRet.ItemStart] = uint8_t(-NOT_EXECUTED);
+          BatchRet.Size = BatchRet.ItemStart + 1;
+          break;
+        }
+        if(BatchRet.Data[BatchRet.ItemStart] == 0) {
+          const uint16_t Size = BatchRet.Size - BatchRet.ItemStart - 3;
+          memcpy(BatchRet.Data + BatchRet.ItemStart + 1, &Size, sizeof(Size));
+        }
+      }
+      InBatch = false;
+      (void)ReturnBytesBuffered(BatchRet.Data, BatchRet.Size); // if TX is stalled ReturnDropped reports it
+    } // ExecuteBatch
+
+    /// writes returned value either to Port or to batch record
+    template<typename T>
+    static bool ReturnWrite(const T &x) {
+      return InBatch?BatchAppend((const uint8_t *)&x, sizeof(x)):TX::write(x);
+    } // ReturnWrite
+
     /// base private message which writes both info and error messages
     /// @param Src - string to output
     /// @param Size - int8_t size of string
     /// @param NonVolat - bool, true if string is static until sent, false by default
     static bool info_message_(const uint8_t *Src, int8_t Size, bool NonVolat = false) {
-      return Port::write_char(Size) &&
-             (NonVolat?Port::write_unbuffered(Src,Size):Port::write(Src,Size)) &&
-             Port::write_byte(sum<uint8_t>(Src,Size));
+      const uint8_t CS = sum<uint8_t>(Src,Size);
+      const size_t Esc = EscBlocks(Size) + EscBlocks(CS) + (NonVolat?0:EscBlocks(Src,Size));
+      return (NonVolat?ReserveTX(3,1 + Esc):ReserveTX(Size+2,Esc)) &&
+             TX::write_char(Size) &&
+             (NonVolat?TX::write_unbuffered(Src,Size):TX::write(Src,Size)) &&
+             TX::write_byte(CS);
     } // info_message_
 
     /// sends error message, checking whether we need padding
     /// @param Src - string to output
     /// @param Size - int8_t size of string
     /// @param NonVolat - bool, true if string is static until sent, false by default
-    static void error_message_(const uint8_t *Src, int8_t Size, bool NonVolat = false) {
+    /// @return false if there was no space in TX buffers
+    static bool error_message_(const uint8_t *Src, int8_t Size, bool NonVolat = false) {
       AVP_ASSERT(Size >= 0);
       // Because Sizes < NUM_ERR_CODES are special error codes we can not have a
       // text error message with this Size. So if it does occur we pad it with some empty
       // bytes
       uint8_t PadSize = 0;
       if(Size < NUM_ERR_CODES) Size += (PadSize = NUM_ERR_CODES-Size);
-
-      AVP_ASSERT(Port::write_char(-Size));
-      if(NonVolat) AVP_ASSERT(Port::write_unbuffered(Src,Size));
-      else AVP_ASSERT(Port::write(Src,Size));
+      if(InBatch) return BatchError(Src, Size, PadSize);
 
       static uint8_t Pad[] = {' ',' '};
       static_assert(sizeof(Pad) == NUM_ERR_CODES-1, "Adjust Pad initialization if NUM_ERR_CODES changes!");
 
-      if(PadSize) AVP_ASSERT(Port::write_unbuffered(Pad,PadSize));
-
-      AVP_ASSERT(Port::write_byte(sum<uint8_t>(Src,Size) + sum<uint8_t>(Pad,PadSize)));
+      const int8_t TextSize = Size - PadSize;
+      const uint8_t Code = uint8_t(-Size), CS = sum<uint8_t>(Src,TextSize) + sum<uint8_t>(Pad,PadSize);
+      // code + text + pad + checksum, bytes equal to Port escape code take a block slot each. Once we got
+      // space writes below can not fail
+      RET_IF_FALSE(ReserveTX(2 + (NonVolat?1:TextSize) + (PadSize?1:0),
+                             (NonVolat?1:EscBlocks(Src,TextSize)) + (PadSize?1:0) + EscBlocks(Code) + EscBlocks(CS)));
+
+      RET_IF_FALSE(TX::write_byte(Code));
+      if(NonVolat) RET_IF_FALSE(TX::write_unbuffered(Src,TextSize));
+      else RET_IF_FALSE(TX::write(Src,TextSize));
+      if(PadSize) RET_IF_FALSE(TX::write_unbuffered(Pad,PadSize));
+      return TX::write_byte(CS);
     } // error_message
 
     /// flashing serial port input
@@ -153,7 +384,111 @@ namespace avp {
       InputParser::Flush();
     } // PurgeRX
 
+    static void ProcessInput() {
+      if constexpr(Queue::Enabled) {
+        if(Queue::Busy()) { // returns have to wait for returns of deferred commands
+          if(Queue::Reserve() == nullptr) return; // queue is full, bytes wait in RX buffer
+          pCapture = &Queue::GetReserved()->Capture;
+          ProcessInput_();
+          pCapture = nullptr;
+          Queue::Commit();
+          return;
+        }
+      }
+      ProcessInput_();
+    } // ProcessInput
+
+    /// sends returns of executed deferred commands and of commands captured behind them
+    static void SendDeferredReturns() {
+      if constexpr(Queue::Enabled) {
+        while(typename Queue::Slot *p = Queue::ToSend()) {
+          if(p->Capture.Overflow) {
+            if(!return_error_str("Deferred command return does not fit!\n")) return;
+          } else { // may be larger than Port TX buffer, so it goes out in chunks as space frees up
+            typename Port::TX_Batch Batch;
+            while(p->SentSize < p->Capture.Size) {
+              const size_t n = TX_Fits(p->Capture.Data + p->SentSize, p->Capture.Size - p->SentSize);
+              if(n == 0 || !Port::write(p->Capture.Data + p->SentSize, n)) return;
+              p->SentSize += n;
+            }
+          }
+          Queue::Release();
+        }
+      }
+    } // SendDeferredReturns
+
+    static void ProcessInput_() {
+      const char *ErrStr = Port::GetError();
+
+      if(ErrStr != nullptr) {
+        debug_printf("UART error:%s!",ErrStr);
+        PurgeRX();
+        Port::RX_Byte_IT(); // we have to restart RX, it may be stopped
+        info_str(ErrStr);
+      } else if(SomethingToRX()) {
+        if(BytesLeftToRead) {
+          if(DestPtr != nullptr) *(DestPtr++) = Port::GetByte(); else Port::GetByte();
+          --BytesLeftToRead;
+        } else if(size_t Size = InputParser::InPlaceSizeWanted()) {
+          // parser takes bulk parameters right from RX buffer if they are continuous there
+          bool Wait;
+          if(const uint8_t *p = Port::PeekRX(Size, &Wait)) {
+            const typename InputParser::ParseError_ Res = InputParser::ParseInPlace(p);
+            Port::SkipRX(Size);
+            ProcessParseResult(Res);
+          } else if(!Wait) ProcessParseResult(InputParser::ParseByte(Port::GetByte())); // wraps, copy it
+        } else {
+          // parameter bytes are copied and checksummed as a block, ParseBlock stops before command execution
+          size_t Avail, Used = 0;
+          typename InputParser::ParseError_ Res = InputParser::NO_ERROR;
+          if(const uint8_t *p = Port::PeekRX(&Avail)) {
+            Res = InputParser::ParseBlock(p, Avail, &Used);
+            Port::SkipRX(Used);
+          }
+          if(Used == 0) Res = InputParser::ParseByte(Port::GetByte());
+          ProcessParseResult(Res);
+        }
+      }
+    } // ProcessInput
+
+    static void ProcessParseResult(typename InputParser::ParseError_ Res) {
+      switch(Res) {
+        case InputParser::WRONG_ID:
+          return_error_str("Command is not defined!\n");
+          PurgeRX();  // Oops
+          break;
+        case InputParser::WRONG_PARAM_SIZE:
+          return_error_str("Too many parameter bytes!\n");
+          PurgeRX();  // Oops
+          break;
+        case InputParser::BAD_CHECKSUM:
+          return_error_code(CS_ERROR);
+          PurgeRX();  // Oops
+          break;
+        case InputParser::NO_ERROR: break;
+        case InputParser::NOOP: (void)ReturnOK(); break;
+        case InputParser::BATCH: ExecuteBatch(); break;
+        default: AVP_ERROR_PRINTF("Unrecognized error code.");
+      } // switch
+    } // ProcessParseResult
+
    public:
+    typedef InputParser Parser;
+
+    static uint32_t TX_WaitTimeout; ///< ms, how long return functions wait for space in TX buffers
+    static uint32_t DroppedReturns; ///< returns not sent (or truncated) because TX was stalled for TX_WaitTimeout
+    static void (*YieldFunc)(); ///< called while waiting for TX space, may be e.g. cycle or RTOS yield
+
+    /**
+     * reserves space in Port TX buffers, waiting for it if necessary
+     * @param Bytes - number of buffered bytes, every unbuffered block takes one byte as well
+     * @param Blocks - number of unbuffered blocks
+     */
+    static bool ReserveTX(size_t Bytes, size_t Blocks = 0) {
+      if(pCapture != nullptr) return true; // capture does not wait, overflow is reported later
+      return Port::WaitForTX_Space(Bytes, Blocks, TX_WaitTimeout, YieldFunc);
+    } // ReserveTX
+
     static void Init(const char *BeaconStr_) {
       Port::Init();
       BeaconStr = BeaconStr_;
@@ -177,47 +512,28 @@ namespace avp {
     /// returns code which indicated that command was not received and has to be resent
     static bool return_error_code(int8_t Code) {
       AVP_ASSERT(Code < NUM_ERR_CODES);
-      return Port::write_char(-Code) && Port::write_char(-Code); // checksum which is equal to error code
+      ReturnBatch Batch;
+      return ReserveTX(2) &&
+             TX::write_char(-Code) && TX::write_char(-Code); // checksum which is equal to error code
     } //  return_error_code
 
     /**
     @brief this function should be called repeatedly as a part of main program loop to maintain communication
     It processes input communication stream byte at a time
+    @note it may be called from YieldFunc while a command handler waits for TX space, input processing is
+    skipped in this case
     @callgraph
     */
     static void cycle() {
-      RunPeriodically<millis,SendBeacon,BeaconPeriod>::cycle();
+      static bool Busy = false; // we are inside ProcessInput
 
-      const char *ErrStr = Port::GetError();
+      RunPeriodically<millis,SendBeacon,BeaconPeriod>::cycle();
 
-      if(ErrStr != nullptr) {
-        debug_printf("UART error:%s!",ErrStr);
-        PurgeRX();
-        Port::RX_Byte_IT(); // we have to restart RX, it may be stopped
-        info_str(ErrStr);
-      } else if(SomethingToRX()) {
-        if(BytesLeftToRead) {
-          if(DestPtr != nullptr) *(DestPtr++) = Port::GetByte(); else Port::GetByte();
-          --BytesLeftToRead;
-        } else {
-          switch(InputParser::ParseByte(Port::GetByte())) {
-            case InputParser::WRONG_ID:
-              return_error_str("Command is not defined!\n");
-              PurgeRX();  // Oops
-              break;
-            case InputParser::WRONG_PARAM_SIZE:
-              return_error_str("Too many parameter bytes!\n");
-              PurgeRX();  // Oops
-              break;
-            case InputParser::BAD_CHECKSUM:
-              return_error_code(CS_ERROR);
-              PurgeRX();  // Oops
-              break;
-            case InputParser::NO_ERROR: break;
-            case InputParser::NOOP: ReturnOK(); break;
-            default: AVP_ERROR_PRINTF("Unrecognized error code.");
-          } // switch
-        }
+      if(!Busy) {
+        RestoreOnReturn<bool> ClearBusy(Busy);
+        Busy = true;
+        SendDeferredReturns();
+        ProcessInput();
       }
       Port::TryToSend();
     } //  cycle
@@ -229,6 +545,7 @@ namespace avp {
     /// @param Size - size_t size of array
     /// @param NonVolat - bool, true if the array would not disappear until sent in background
     static bool info_message(const uint8_t *Src, size_t Size, bool NonVolat) {
+      ReturnBatch Batch;
       while(Size > INT8_MAX)  {
         if(!info_message_(Src,INT8_MAX,NonVolat)) return false;
         Src += INT8_MAX;
@@ -247,17 +564,20 @@ namespace avp {
     } // info_str
 
     static PRINTF_WRAPPER(int, info_printf, vprintf<info_message>)
+    /// info_printf with format parsed at compile time, see Format.hpp
+    template<class Fmt, typename... Args>
+    static bool info_format(Fmt f, const Args &... a) { return format<info_message>(f, a...); }
 
     /// sends error message of any size, splits if necessary into chunks
     /// @param Src - byte array to output
     /// @param Size - size_t size of array
     /// @param NonVolat - bool, true if the array would not disappear until sent in background
     static bool return_error_message(const uint8_t *Src, size_t Size, bool NonVolat) {
-      if(Size > INT8_MAX) {
-        error_message_(Src,INT8_MAX,NonVolat);
-        info_message(Src+INT8_MAX,Size-INT8_MAX,NonVolat);
-      } else error_message_(Src,Size,NonVolat);
-      return true;
+      ReturnBatch Batch;
+      if(Size > INT8_MAX)
+        return error_message_(Src,INT8_MAX,NonVolat) &&
+               info_message(Src+INT8_MAX,Size-INT8_MAX,NonVolat);
+      else return error_message_(Src,Size,NonVolat);
     } // return_error_message
 
     /// @note - I do not use default parameters because it screws templates
@@ -277,22 +597,36 @@ namespace avp {
     } // return_error_str
 
     static PRINTF_WRAPPER(int, return_error_printf, vprintf<return_error_message>)
-
-    static bool ReturnBytesBuffered(const uint8_t *src, size_t size) {
-      return Port::write_byte(0) && // success code
-             write_buffered<Port::write>::object((uint16_t)size) && // size
-             Port::write(src, size) && //data
-             Port::write_byte(sum<uint8_t>(src,size)); // checksum
+    template<class Fmt, typename... Args>
+    static bool return_error_format(Fmt f, const Args &... a) { return format<return_error_message>(f, a...); }
+
+    /// @note return larger than Port TX buffers is streamed in chunks, see StreamTX
+    [[nodiscard]] static bool ReturnBytesBuffered(const uint8_t *src, size_t size) {
+      if(InBatch) return BatchAppend(src, size);
+      ReturnBatch Batch; // one doorbell for the whole return block
+      const uint8_t CS = sum<uint8_t>(src,size);
+      if(!ReserveReturn(size + 4, EscBlocks(src, size) + EscBlocks(uint16_t(size)) + EscBlocks(CS)))
+        return ReturnDropped();
+      return (StreamTX(uint8_t(0)) && // success code
+              StreamTX(uint16_t(size)) && // size
+              StreamTX(src, size) && //data
+              StreamTX(CS)) || ReturnDropped(true); // checksum
     } // Protocol::ReturnBytesBuffered
-    static bool ReturnBytesUnbuffered(const uint8_t *src, size_t size, typename Port::tReleaseFunc pFunc = nullptr)  {
-      return Port::write_byte(0) &&
-             write_buffered<Port::write>::object((uint16_t)size) &&
-             Port::write_unbuffered(src, size, pFunc) &&
-             Port::write_byte(sum<uint8_t>(src,size));
+    [[nodiscard]] static bool ReturnBytesUnbuffered(const uint8_t *src, size_t size, typename Port::tReleaseFunc pFunc = nullptr)  {
+      if(InBatch) { // copied, so data may be released right away
+        BatchAppend(src, size);
+        if(pFunc != nullptr) pFunc();
+        return true;
+      }
+      ReturnBatch Batch;
+      const uint8_t CS = sum<uint8_t>(src,size);
+      if(!ReserveTX(5,1 + EscBlocks(uint16_t(size)) + EscBlocks(CS))) return ReturnDropped();
+      return TX::write_byte(0) &&
+             write_buffered<TX::write>::object((uint16_t)size) &&
+             TX::write_unbuffered(src, size, pFunc) &&
+             TX::write_byte(CS);
     } // Protocol::ReturnBytesUnbuffered;
 
-#define RET_IF_FALSE(exp) do{if(!(exp)) return false;}while(0)
-
     /** this function allows us to return several blocks with one call
     it takes variable number of arguments in triplets or quadruplets
     all integer values get promoted to "int" in variable list, so that's the only type
@@ -301,7 +635,7 @@ namespace avp {
     pFunc is present only when Buffered is false
     the end of the list is marked by src == nullptr. numbytes and Buffered are absent
     */
-    static bool ReturnMultiByPtrs(const void *src, ...) {
+    [[nodiscard]] static bool ReturnMultiByPtrs(const void *src, ...) {
       va_list ap, ap_size;
 
       va_start(ap, src);
@@ -310,60 +644,81 @@ namespace avp {
       va_copy(ap_size, ap);
       auto src_copy = src;
       uint16_t total_bytes = 0;
+      size_t buffered_bytes = 4, blocks = 0; // status, size and checksum are buffered
+      uint8_t total_cs = 0;
 
       while(src_copy != nullptr) {
-        total_bytes += va_arg(ap_size,int);
+        int numbytes = va_arg(ap_size,int);
+        total_bytes += numbytes;
+        total_cs += sum((const uint8_t *)src_copy,numbytes);
 
-        if(!va_arg(ap_size,int)) va_arg(ap_size, typename Port::tReleaseFunc);
+        if(!va_arg(ap_size,int)) {
+          va_arg(ap_size, typename Port::tReleaseFunc);
+          ++buffered_bytes; ++blocks;
+        } else {
+          buffered_bytes += numbytes;
+          blocks += EscBlocks(src_copy, numbytes);
+        }
         src_copy = va_arg(ap_size, const uint8_t *);
       }
       va_end(ap_size);
+      blocks += EscBlocks(total_bytes) + EscBlocks(total_cs);
+
+      if(InBatch) { // everything is copied into batch record
+        while(src != nullptr) {
+          int numbytes = va_arg(ap,int);
+          (void)ReturnBytesUnbuffered((const uint8_t *)src, numbytes,
+                                      va_arg(ap,int)?nullptr:va_arg(ap, typename Port::tReleaseFunc));
+          src = va_arg(ap, const uint8_t *);
+        }
+        va_end(ap);
+        return true;
+      }
 
-      // second pass - sending
-      RET_IF_FALSE(Port::write_byte(0)); // status OK
-      RET_IF_FALSE(write_buffered<Port::write>::object(total_bytes)); // sending size
+      if(!ReserveReturn(buffered_bytes, blocks)) { va_end(ap); return ReturnDropped(); }
+      ReturnBatch Batch;
 
-      uint8_t cs = 0;
+      // second pass - sending, larger than Port TX buffers is streamed
+      bool OK = StreamTX(uint8_t(0)) && StreamTX(total_bytes); // status OK and size
 
-      while(src != nullptr) {
+      while(OK && src != nullptr) {
         int numbytes = va_arg(ap,int);
 
         if(!va_arg(ap,int)) // if not Buffered
-          RET_IF_FALSE(Port::write_unbuffered((const uint8_t *)src, numbytes, va_arg(ap, typename Port::tReleaseFunc)));
+          OK = StreamTX_Unbuffered((const uint8_t *)src, numbytes, va_arg(ap, typename Port::tReleaseFunc));
         else
-          RET_IF_FALSE(Port::write((const uint8_t *)src,numbytes));
-        cs += sum((const uint8_t *)src,numbytes);
+          OK = StreamTX((const uint8_t *)src,numbytes);
         src = va_arg(ap, const uint8_t *);
       }
       va_end(ap);
 
-      RET_IF_FALSE(Port::write_byte(cs));
-
-      return true;
+      return (OK && StreamTX(total_cs)) || ReturnDropped(true);
     } // ReturnMultiByPtrs
 
 #if 1 // FIXME the logic of this thing is too complicated
-    static uint16_t ReturnMultiSize;
-    static uint8_t ReturnMultiCS;
+    static AVP_THREAD_LOCAL uint16_t ReturnMultiSize;
+    static AVP_THREAD_LOCAL uint8_t ReturnMultiCS;
 
     template<typename T>
     struct ReturnGuard {
       ReturnGuard() { ReturnMultiSize += sizeof(T); }
-      ~ReturnGuard() { if((ReturnMultiSize -= sizeof(T)) == 0) AVP_ASSERT(Port::write_byte(ReturnMultiCS)); }
+      ~ReturnGuard() { // space for checksum is reserved, so it can not fail
+        if((ReturnMultiSize -= sizeof(T)) == 0 && !InBatch) TX::write_byte(ReturnMultiCS);
+      }
     };
 
     /**
      * // this is specialized template function. It is called when we run out of arguments in the variadic template
      */
     template<typename T>
-    static bool ReturnMultiInReverse(const T *x) {
+    [[nodiscard]] static bool ReturnMultiInReverse(const T *x) {
       AVP_ASSERT(ReturnMultiSize != 0); // we should not use ReturnMultiInReverse to send a single pointed value
 
       ReturnGuard<T> MakeSure_ReturnMultiSize_LeftCorrect;
 
-      RET_IF_FALSE(Port::write(ReturnMultiSize));
-      RET_IF_FALSE(Port::write(*x));
-      ReturnMultiCS += sum<uint8_t>(x);
+      if(!InBatch) RET_IF_FALSE(TX::write(ReturnMultiSize)); // record size is filled by ExecuteBatch
+      RET_IF_FALSE(ReturnWrite(*x));
+      ReturnMultiCS += sum<uint8_t>((const uint8_t *)x,sizeof(T));
       return true;
     } // ReturnMultiInReverse
 
@@ -374,23 +729,35 @@ namespace avp {
      * @note Values are sent over in reverse order
      */
     template<typename T, typename... Ts>
-    static bool ReturnMultiInReverse(const T *x, Ts... Rest) {
-      if(ReturnMultiSize == 0) {
-        RET_IF_FALSE(Port::write_byte(0)); // success
+    [[nodiscard]] static bool ReturnMultiInReverse(const T *x, Ts... Rest) {
+      ReturnBatch Batch; // destroyed after ReturnGuard, which writes checksum
+
+      if(ReturnMultiSize == 0 && !InBatch) {
+        const uint16_t Size = sizeof(T) + (sizeof(std::remove_pointer_t<Ts>) + ...);
+        const uint8_t CS = sum<uint8_t>((const uint8_t *)x,sizeof(T)) +
+                           (sum<uint8_t>((const uint8_t *)Rest,sizeof(*Rest)) + ...);
+        if(!ReserveTX(4 + Size, EscBlocks(x,sizeof(T)) + (EscBlocks(Rest,sizeof(*Rest)) + ...) +
+                                EscBlocks(Size) + EscBlocks(CS))) return ReturnDropped();
+        RET_IF_FALSE(TX::write_byte(0)); // success
         ReturnMultiCS = 0;
       }
 
       ReturnGuard<T> MakeSure_ReturnMultiSize_LeftCorrect;
 
-      ReturnMultiCS += sum<uint8_t>(x);
+      ReturnMultiCS += sum<uint8_t>((const uint8_t *)x,sizeof(T));
       RET_IF_FALSE(ReturnMultiInReverse(Rest...));
-      RET_IF_FALSE(Port::write(*x));
+      RET_IF_FALSE(ReturnWrite(*x));
       return true;
     } // ReturnMulti
 #endif
 
-    static void ReturnOK() {
-      AVP_ASSERT(write_buffered<Port::write>::object(uint32_t(0)));  // 1 byte status, 2 - size and 1 - checksum
+    /// return functions return false if return could not be sent (e.g. TX was throttled for TX_WaitTimeout),
+    /// so command handler may retry or give up. Communicating program gets an error block instead, see ReturnDropped
+    [[nodiscard]] static bool ReturnOK() {
+      if(InBatch) return true; // empty successful record is there already
+      ReturnBatch Batch;
+      if(!ReserveTX(4)) return ReturnDropped();
+      return write_buffered<TX::write>::object(uint32_t(0));  // 1 byte status, 2 - size and 1 - checksum
       // debug_printf("Four zeros\n");
     }
 
@@ -410,40 +777,121 @@ namespace avp {
 
     // some useful templates
     template<typename type>
-    static void Return(const type &X) {
-      AVP_ASSERT(ReturnBytesBuffered((const uint8_t *)&X,sizeof(X)));
+    [[nodiscard]] static bool Return(const type &X) {
+      return ReturnBytesBuffered((const uint8_t *)&X,sizeof(X));
     }
     // some useful templates
     template<typename type>
-    static void ReturnUnbuffered(const type &X, typename Port::tReleaseFunc pFunc = nullptr) {
-      AVP_ASSERT(ReturnBytesUnbuffered((const uint8_t *)&X,sizeof(X),pFunc));
+    [[nodiscard]] static bool ReturnUnbuffered(const type &X, typename Port::tReleaseFunc pFunc = nullptr) {
+      return ReturnBytesUnbuffered((const uint8_t *)&X,sizeof(X),pFunc);
     }
     /**
      * @param size is in "type" elements, not bytes
      */
     template<typename type>
-    static void ReturnByPtr(const type *p, size_t size=1) {
-      AVP_ASSERT(write_buffered<ReturnBytesBuffered>::array(p,size));
+    [[nodiscard]] static bool ReturnByPtr(const type *p, size_t size=1) {
+      return write_buffered<ReturnBytesBuffered>::array(p,size);
     }
 
     // We do not have to do ReturnUnbuffered, there always should be pointer
     template<typename type>
-    static void ReturnUnbufferedByPtr(const type *p, size_t size=1, typename Port::tReleaseFunc pFunc = nullptr) {
-      AVP_ASSERT(write_unbuffered<ReturnBytesUnbuffered>::array(p,size,pFunc));
+    [[nodiscard]] static bool ReturnUnbufferedByPtr(const type *p, size_t size=1, typename Port::tReleaseFunc pFunc = nullptr) {
+      return write_unbuffered<ReturnBytesUnbuffered>::array(p,size,pFunc);
     }
+
+    /**
+     * command handler wrapper which defers Func execution to worker, see \ref Deferred. E.g.
+     * @code
+     *   Parser::AddCommand("FW", Pr::Deferred<FlashWrite, 6>, 6);
+     *   Parser::AddCommand("UP", Pr::Deferred<TypedHandler<Upload>::Call, Parser::VAR_PARAM_NUM>, Parser::VAR_PARAM_NUM);
+     * @endcode
+     * @tparam NumParamBytes - the same as in command registration
+     */
+    template<CommandFunc_ Func, uint8_t NumParamBytes>
+    static void Deferred(const uint8_t Params[]) {
+      if constexpr(!Queue::Enabled) Func(Params);
+      else {
+        static_assert(NumParamBytes == CommandParser::VAR_PARAM_NUM || NumParamBytes <= Queue::GetMaxParamBytes(),
+                      "Modify Queue MaxParamBytes to accommodate parameters.");
+        if(InBatch) { // batch return is a single block, so it is executed right away
+          Func(Params);
+          return;
+        }
+        const size_t Size = NumParamBytes == CommandParser::VAR_PARAM_NUM?Params[0] + 1:NumParamBytes;
+        if(Size > Queue::GetMaxParamBytes()) {
+          return_error_str("Too many parameter bytes to defer command!\n");
+          return;
+        }
+        const bool OwnSlot = Queue::GetReserved() == nullptr; // otherwise ProcessInput queues it
+        typename Queue::Slot *p = Queue::Reserve();
+        AVP_ASSERT(p != nullptr); // ProcessInput does not parse when queue is full
+        memcpy(p->Params, Params, Size);
+        p->Func = Func;
+        if(OwnSlot) Queue::Commit();
+      }
+    } // Deferred
+
+    /// executes deferred command, should be called by worker (a thread or low priority loop) continuously
+    /// @return false if there was nothing to do
+    static bool RunDeferred() {
+      static_assert(Queue::Enabled, "Protocol has no CommandQueue!");
+      typename Queue::Slot *p = Queue::ToExecute();
+      if(p == nullptr) return false;
+      if(p->Func != nullptr) {
+        RestoreOnReturn<ReturnCapture *> ClearCapture(pCapture);
+        pCapture = &p->Capture;
+        p->Func(p->Params);
+      }
+      Queue::Executed();
+      return true;
+    } // RunDeferred
+
+#ifdef AVP_COMMAND_PROFILE
+    /**
+     * command handler returning per-command statistics, see CommandProfile.hpp. It should be registered by user
+     * under a command ID of choice with 1 parameter byte, if it is not 0 statistics are reset after being sent.
+     * Returns InputParser::Profile::GetSize() CommandProfile::Entry structures, unused ones have Count == 0
+     */
+    static void ProfileCommand(const uint8_t Params[]) {
+      typedef typename InputParser::Profile Profile;
+      const typename Profile::Entry *p = Profile::Snapshot(Params[0] != 0); // handlers keep updating the table
+      if(p == nullptr) return_error_str("Previous profile is still being sent!\n");
+      else if(!ReturnBytesUnbuffered((const uint8_t *)p, Profile::GetSize()*sizeof(typename Profile::Entry),
+                                     Profile::Release)) {
+        Profile::Release();
+        return_error_str("Profile does not fit!\n");
+      }
+    } // ProfileCommand
+#endif
+
+    /// command handler which lets communicating program throttle us, see \ref FlowControl
+    static void FlowControlCommand(const uint8_t Params[]) {
+      uint16_t Credit = Ptr2type<uint16_t>(Params);
+      if(Credit == 0) Port::PauseTX();
+      else if(Credit == UINT16_MAX) Port::ResumeTX();
+      else Port::GrantCredit(Credit);
+      (void)ReturnOK(); // goes out as soon as we are allowed to transmit
+    } // FlowControlCommand
   }; //class Protocol
 
 // following defines are just for code clearness, do not use elsewhere
-#define _TEMPLATE_DECL_ template<class Port, class InputParser, uint16_t BeaconPeriod, void (*ConnectFunc)(), void (*DropFunc)()>
-#define _TEMPLATE_SPEC_ Protocol<Port, InputParser, BeaconPeriod, ConnectFunc, DropFunc>
+#define _TEMPLATE_DECL_ template<class Port, class InputParser, uint16_t BeaconPeriod, void (*ConnectFunc)(), void (*DropFunc)(), \
+                                 class Queue>
+#define _TEMPLATE_SPEC_ Protocol<Port, InputParser, BeaconPeriod, ConnectFunc, DropFunc, Queue>
 
   _TEMPLATE_DECL_ bool _TEMPLATE_SPEC_::PortConnected = false;
   _TEMPLATE_DECL_ const char *_TEMPLATE_SPEC_::BeaconStr;
   _TEMPLATE_DECL_ size_t _TEMPLATE_SPEC_::BytesLeftToRead = 0;
   _TEMPLATE_DECL_ uint8_t *_TEMPLATE_SPEC_::DestPtr = nullptr;
-
-  _TEMPLATE_DECL_ uint16_t _TEMPLATE_SPEC_:: ReturnMultiSize = 0;
-  _TEMPLATE_DECL_ uint8_t _TEMPLATE_SPEC_:: ReturnMultiCS;
+  _TEMPLATE_DECL_ typename _TEMPLATE_SPEC_::BatchReturn_ _TEMPLATE_SPEC_::BatchRet;
+  _TEMPLATE_DECL_ AVP_THREAD_LOCAL bool _TEMPLATE_SPEC_::InBatch = false;
+  _TEMPLATE_DECL_ AVP_THREAD_LOCAL ReturnCapture *_TEMPLATE_SPEC_::pCapture = nullptr;
+  _TEMPLATE_DECL_ uint32_t _TEMPLATE_SPEC_::TX_WaitTimeout = 100;
+  _TEMPLATE_DECL_ uint32_t _TEMPLATE_SPEC_::DroppedReturns = 0;
+  _TEMPLATE_DECL_ void (*_TEMPLATE_SPEC_::YieldFunc)() = nullptr;
+
+  _TEMPLATE_DECL_ AVP_THREAD_LOCAL uint16_t _TEMPLATE_SPEC_:: ReturnMultiSize = 0;
+  _TEMPLATE_DECL_ AVP_THREAD_LOCAL uint8_t _TEMPLATE_SPEC_:: ReturnMultiCS;
 
 #undef _TEMPLATE_DECL_
 #undef _TEMPLATE_SPEC_
@@ -0,0 +1,518 @@
+/**
+  @file
+  @author Alexander Panasyuk
+  @brief reliable transport on top of avp::Port for lossy links (radio, RS-485).
+
+  avp::ReliablePort provides the same API avp::Protocol expects from its Port, so it is used as a drop-in:
+  @code
+    typedef avp::ReliablePort<avp::PortByteTX<UART>> RPort;
+    typedef avp::Protocol<RPort, avp::CommandChain<uint16_t>, 1000> Proto;
+  @endcode
+  Both ends have to run it.
+
+  Outgoing data are cut into sequence-numbered frames, every frame is kept until the peer acknowledges it and
+  is retransmitted selectively - only frames which are not acknowledged within RetransmitTimeout, or which
+  the peer reports missing, are resent. So a lost or corrupted byte costs a single frame retransmit, and
+  there is no need in NOOP resynchronization.
+
+  Frame format:
+    - SYNC byte (0xA5)
+    - Ctl byte - DATA(0) or ACK(1)
+    - Seq byte - for DATA frame sequence number, for ACK frame the sequence number receiver expects next
+      (cumulative acknowledgment: all frames before it are received)
+    - Len byte - payload size
+    - payload, for ACK frame it is uint16_t bitmap of frames received out of order, bit i is frame Seq+1+i
+    - uint16_t CRC16-CCITT of Ctl, Seq, Len and payload, little endian
+    .
+  Frames with bad CRC are dropped, receiver hunts for the next SYNC.
+
+  No data are copied for transmission beyond what Port does. Buffered writes are collected into
+  MaxPayload-sized segments, unbuffered blocks are kept by reference the same way as Port does it, and frame
+  payloads are handed to Port as unbuffered blocks pointing into segments. So unbuffered block release function
+  is called only after all its frames are acknowledged and Port is done with them.
+
+  Sequence numbers start from 0 on Init() or Reset(), so both ends have to start session together (e.g. after
+  initial handshake).
+  */
+
+#ifndef AVP_RELIABLE_PORT_HPP_
+#define AVP_RELIABLE_PORT_HPP_
+
+/// @cond
+#include <stdint.h>
+#include <string.h>
+/// @endcond
+#include "General.hpp"
+#include "MyTime.hpp"
+#include "CircBuffer.hpp"
+#include "Port.hpp"
+
+namespace avp {
+  /**
+   * @tparam Port_ - link level port, PortByteTX or PortBlockTX
+   * @tparam Log2Window - log2 of maximum number of unacknowledged frames, should be <= 4
+   * @tparam MaxPayload - maximum frame payload
+   * @tparam Log2Segments - log2 of number of TX segments. Segment is either MaxPayload bytes of buffered
+   *  data or a reference to an unbuffered block
+   * @tparam Log2_RX_Buf_Size - log2 of received data buffer size
+   * @tparam RetransmitTimeout - ms
+   */
+  template<class Port_, uint8_t Log2Window = 3, uint8_t MaxPayload = 64, uint8_t Log2Segments = 4,
+           uint8_t Log2_RX_Buf_Size = AVP_PORT_DEF_RX_BUF_SIZE, uint16_t RetransmitTimeout = 50>
+  struct ReliablePort: protected Port_ {
+    static_assert(Log2Window <= 4, "ACK bitmap covers 16 frames only!");
+    static_assert(Log2Segments < 8, "Segment counters are uint8_t!");
+    static_assert((size_t(1) << Log2_RX_Buf_Size) > MaxPayload, "RX buffer should fit a frame!");
+
+    typedef typename Port_::tReleaseFunc tReleaseFunc;
+    using Port_::GetError;
+    using Port_::RX_Byte_IT;
+    using Port_::EnableFlowControl;
+    using Port_::DisableFlowControl;
+    using Port_::GrantCredit;
+    using Port_::PauseTX;
+    using Port_::ResumeTX;
+    using Port_::IsThrottled;
+    using Port_::SetTap;
+
+    static uint32_t Retransmits; ///< purely informative variable, counts retransmitted frames
+    static uint32_t BadFrames; ///< purely informative variable, counts frames dropped because of CRC or size
+
+   protected:
+    enum Ctl_ {DATA, ACK};
+    static constexpr uint8_t SYNC = 0xA5;
+    static constexpr uint8_t Window = 1 << Log2Window;
+    static constexpr uint8_t NumSegments = 1 << Log2Segments;
+    // Port_ space frame takes: SYNC + 3 header bytes + payload block escape + 2 CRC bytes. Every buffered byte
+    // equal to Port ESC_code takes a block slot as well, so we are conservative with blocks
+    static constexpr size_t FrameBytes = 7, FrameBlocks = FrameBytes;
+    static_assert(FrameBytes + 1 <= Port_::TX_Capacity() && FrameBlocks + 1 <= Port_::TX_BlockCapacity(),
+                  "Port_ TX buffers can not fit a frame, increase Log2_TX_Buf_size or Log2_TX_BlockBufSize!");
+
+    struct Segment {
+      const uint8_t *Ptr;
+      size_t Size;
+      tReleaseFunc pReleaseFunc;
+      uint32_t Ticket; //!< Port_ release ticket of the last frame sent from this segment
+      bool Closed; //!< no more data will be added, so it may be framed
+      bool Acked; //!< all its frames are acknowledged
+      uint8_t Buf[MaxPayload]; //!< for buffered data
+    }; // Segment
+
+    struct Frame {
+      const uint8_t *Ptr;
+      uint8_t Len;
+      uint8_t Seg; //!< index of segment payload comes from
+      bool LastOfSeg;
+      bool Acked; //!< selectively acknowledged
+      bool Pending; //!< should be (re)sent as soon as Port_ has space
+      bool Sent; //!< was sent at least once
+      uint16_t CRC;
+      Time_t SentAt;
+    }; // Frame
+
+    struct RX_Slot {
+      bool Valid;
+      uint8_t Len;
+      uint8_t Data[MaxPayload];
+    }; // RX_Slot
+
+    // all counters below are free-running, indexes are obtained by masking
+    static Segment Segs[NumSegments];
+    static uint8_t SegRead, SegSend, SegWrite; //!< oldest not released, next to frame, next to write
+    static size_t SendOffset; //!< in segment SegSend
+    static Frame Frames[Window];
+    static uint8_t FrameBase, FrameNext; //!< oldest unacknowledged frame, next sequence number to assign
+    static uint32_t Queued; //!< number of payload blocks handed to Port_
+    static volatile uint32_t Released; //!< number of payload blocks Port_ is done with, written in Port_ callbacks
+    static uint8_t TX_BatchDepth;
+
+    static RX_Slot RX_Slots[Window];
+    static uint8_t RxNext; //!< next sequence number to deliver
+    static bool AckPending;
+    static CircBufferPWR2<uint8_t, Log2_RX_Buf_Size, uint16_t> BufferRX; //!< delivered in order data
+    static uint8_t In[3 + MaxPayload + 2]; //!< incoming frame after SYNC
+    static uint16_t InI; //!< number of bytes in In + 1, 0 when we are hunting for SYNC, MaxPayload + 5 at most
+
+    static uint8_t SegsUsed() { return uint8_t(SegWrite - SegRead); }
+    static Segment &Seg(uint8_t i) { return Segs[i & (NumSegments - 1)]; }
+    static Frame &Frm(uint8_t Seq) { return Frames[Seq & (Window - 1)]; }
+
+    /// @return segment buffered data are written to, nullptr if there is none
+    static Segment *OpenSegment() {
+      if(SegsUsed() == 0) return nullptr;
+      Segment &s = Seg(SegWrite - 1);
+      return s.Closed?nullptr:&s;
+    } // OpenSegment
+
+    static void CloseOpenSegment() {
+      Segment *s = OpenSegment();
+      if(s != nullptr && s->Size != 0) s->Closed = true;
+    } // CloseOpenSegment
+
+    static Segment &NewSegment(const uint8_t *Ptr, size_t Size, tReleaseFunc pReleaseFunc, bool Closed) {
+      Segment &s = Seg(SegWrite++);
+      s.Ptr = Ptr == nullptr?s.Buf:Ptr;
+      s.Size = Size;
+      s.pReleaseFunc = pReleaseFunc;
+      s.Ticket = Queued;
+      s.Closed = Closed;
+      s.Acked = false;
+      return s;
+    } // NewSegment
+
+    /// copies bytes into segments, does not check space
+    static void put_bytes_(const uint8_t *p, size_t Size) {
+      while(Size) {
+        Segment *s = OpenSegment();
+        if(s == nullptr) s = &NewSegment(nullptr, 0, nullptr, false);
+        size_t n = Size < MaxPayload - s->Size?Size:MaxPayload - s->Size;
+        memcpy(s->Buf + s->Size, p, n);
+        s->Size += n;
+        p += n;
+        Size -= n;
+        if(s->Size == MaxPayload) s->Closed = true;
+      }
+    } // put_bytes_
+
+    static size_t OpenRoom() {
+      const Segment *s = OpenSegment();
+      return s == nullptr?0:MaxPayload - s->Size;
+    } // OpenRoom
+
+    /// Port_ calls it when it is done with payload block
+    static void PayloadReleased() { ++Released; }
+
+    static void ReleaseSegments() {
+      while(SegRead != SegSend && Seg(SegRead).Acked && int32_t(Released - Seg(SegRead).Ticket) >= 0) {
+        if(Seg(SegRead).pReleaseFunc != nullptr) (*Seg(SegRead).pReleaseFunc)();
+        ++SegRead;
+      }
+    } // ReleaseSegments
+
+    /// cuts closed segments into frames while window allows
+    static void MakeFrames() {
+      while(uint8_t(FrameNext - FrameBase) < Window && SegSend != SegWrite && Seg(SegSend).Closed) {
+        Segment &s = Seg(SegSend);
+        Frame &f = Frm(FrameNext);
+        f.Ptr = s.Ptr + SendOffset;
+        f.Len = s.Size - SendOffset < MaxPayload?s.Size - SendOffset:MaxPayload;
+        f.Seg = SegSend;
+        f.Acked = false;
+        f.Pending = true;
+        f.Sent = false;
+        const uint8_t Hdr[] = {DATA, FrameNext, f.Len};
+        f.CRC = Crc16(f.Ptr, f.Len, Crc16(Hdr, sizeof(Hdr)));
+        if((f.LastOfSeg = (SendOffset += f.Len) == s.Size)) {
+          ++SegSend;
+          SendOffset = 0;
+        }
+        ++FrameNext;
+      }
+    } // MakeFrames
+
+    static bool SendFrame(uint8_t Seq) {
+      if(!Port_::HasTX_Space(FrameBytes, FrameBlocks)) return false;
+      Frame &f = Frm(Seq);
+      Port_::BeginTX();
+      Port_::write_byte(SYNC);
+      Port_::write_byte(DATA);
+      Port_::write_byte(Seq);
+      Port_::write_byte(f.Len);
+      Port_::write_unbuffered(f.Ptr, f.Len, PayloadReleased);
+      Seg(f.Seg).Ticket = ++Queued;
+      Port_::write(f.CRC);
+      Port_::CommitTX();
+      if(f.Sent) ++Retransmits;
+      f.Sent = true;
+      f.Pending = false;
+      f.SentAt = millis();
+      return true;
+    } // SendFrame
+
+    /// sends frames which are new, timed out or reported missing
+    static void SendFrames() {
+      for(uint8_t Seq = FrameBase; Seq != FrameNext; ++Seq) {
+        const Frame &f = Frm(Seq);
+        if(f.Acked || (!f.Pending && millis() - f.SentAt < RetransmitTimeout)) continue;
+        if(!SendFrame(Seq)) break;
+      }
+    } // SendFrames
+
+    static bool SendAck() {
+      if(!Port_::HasTX_Space(FrameBytes + 1, FrameBlocks + 1)) return false;
+      uint16_t Sack = 0;
+      for(uint8_t i = 0; i < Window - 1; ++i)
+        if(RX_Slots[(RxNext + 1 + i) & (Window - 1)].Valid) Sack |= 1U << i;
+      const uint8_t Hdr[] = {ACK, RxNext, sizeof(Sack)};
+      Port_::BeginTX();
+      Port_::write_byte(SYNC);
+      Port_::write(Hdr, sizeof(Hdr));
+      Port_::write(Sack);
+      Port_::write(Crc16((const uint8_t *)&Sack, sizeof(Sack), Crc16(Hdr, sizeof(Hdr))));
+      Port_::CommitTX();
+      AckPending = false;
+      return true;
+    } // SendAck
+
+    static void ProcessAck(uint8_t Next, uint16_t Sack) {
+      if(uint8_t(Next - FrameBase) > uint8_t(FrameNext - FrameBase)) return; // stale or bogus
+      for(; FrameBase != Next; ++FrameBase)
+        if(Frm(FrameBase).LastOfSeg) Seg(Frm(FrameBase).Seg).Acked = true;
+      for(uint8_t i = 0; i < Window - 1; ++i) {
+        const uint8_t Seq = Next + 1 + i;
+        if((Sack >> i) & 1U && uint8_t(Seq - FrameBase) < uint8_t(FrameNext - FrameBase)) Frm(Seq).Acked = true;
+      }
+      // peer has got frames after FrameBase, so FrameBase got lost. Do not wait for timeout, but do not resend
+      // it on every ACK either
+      if(Sack != 0 && FrameBase != FrameNext) {
+        Frame &f = Frm(FrameBase);
+        if(!f.Pending && millis() - f.SentAt >= RetransmitTimeout/4) f.Pending = true;
+      }
+    } // ProcessAck
+
+    static void ProcessFrame() {
+      const uint8_t Ctl = In[0], Seq = In[1], Len = In[2];
+      if(Ctl == ACK) {
+        if(Len == sizeof(uint16_t)) ProcessAck(Seq, In[3] | (uint16_t(In[4]) << 8));
+      } else if(Ctl == DATA) {
+        if(uint8_t(Seq - RxNext) < Window) {
+          RX_Slot &s = RX_Slots[Seq & (Window - 1)];
+          if(!s.Valid) {
+            memcpy(s.Data, In + 3, s.Len = Len);
+            s.Valid = true;
+          }
+        } // otherwise it is a duplicate, our ACK got lost
+        AckPending = true;
+      }
+    } // ProcessFrame
+
+    static void ParseLinkByte(uint8_t b) {
+      if(InI == 0) { // hunting for frame start
+        if(b == SYNC) InI = 1;
+        return;
+      }
+      In[InI - 1] = b;
+      if(InI == 3 && b > MaxPayload) { // Len is bad
+        ++BadFrames;
+        InI = 0;
+        return;
+      }
+      if(InI >= 3 && InI == 3 + In[2] + 2) {
+        const size_t Size = 3 + In[2];
+        if(Crc16(In, Size) == (In[Size] | (uint16_t(In[Size + 1]) << 8))) ProcessFrame();
+        else ++BadFrames;
+        InI = 0;
+      } else ++InI;
+    } // ParseLinkByte
+
+    /// moves in order frames into BufferRX
+    static void Deliver() {
+      for(RX_Slot *s; (s = &RX_Slots[RxNext & (Window - 1)])->Valid && BufferRX.LeftToWrite() >= s->Len; ++RxNext) {
+        for(uint8_t i = 0; i < s->Len; ++i) BufferRX.Write_(s->Data[i]);
+        s->Valid = false;
+        AckPending = true; // cumulative ACK moved
+      }
+    } // Deliver
+
+    static void ProcessLinkRX() {
+      uint8_t b;
+      while(Port_::read(&b)) ParseLinkByte(b);
+      Deliver();
+      if(AckPending) SendAck();
+    } // ProcessLinkRX
+
+    static void KickTX() { if(TX_BatchDepth == 0) TryToSend(); }
+
+    /// number of segments writing Bytes buffered bytes and Blocks unbuffered blocks may take
+    static size_t SegsNeeded(size_t Bytes, size_t Blocks) {
+      // every block may split buffered data, creating extra partial segment
+      return (Bytes + MaxPayload - 1)/MaxPayload + 2*Blocks;
+    } // SegsNeeded
+   public:
+    template<typename... Args>
+    static void Init(Args... args) {
+      Port_::Init(args...);
+      Reset();
+    } // Init
+
+    /**
+     * starts a new session, unacknowledged data are dropped. Port_ may still be sending blocks pointing into
+     * segments, so segments are not reused until Port_ is done with them, their release functions are called then
+     */
+    static void Reset() {
+      for(uint8_t i = SegRead; i != SegWrite; ++i) {
+        Seg(i).Closed = true;
+        Seg(i).Acked = true; // goes as soon as Port_ releases its last frame, see ReleaseSegments
+      }
+      SegSend = SegWrite;
+      SendOffset = 0;
+      FrameBase = FrameNext = 0;
+      for(auto &s: RX_Slots) s.Valid = false;
+      RxNext = 0;
+      AckPending = false;
+      BufferRX.Clear();
+      InI = 0;
+      ReleaseSegments();
+    } // Reset
+
+    /**
+     * services the link - processes received frames and ACKs, (re)transmits frames. Has the same name as
+     * HW_IO_ function because Protocol and Port call it for the same purpose
+     */
+    static void TryToSend() {
+      ProcessLinkRX();
+      if(TX_BatchDepth == 0) CloseOpenSegment();
+      ReleaseSegments();
+      MakeFrames();
+      SendFrames();
+      Port_::TryToSend();
+    } // TryToSend
+
+    // *************** TRANSMISSION FUNCTIONS ********************
+    // ALL write function return false if buffer is overrun and true if OK
+    static bool write(const uint8_t *Ptr, size_t Size) {
+      if(Size > TX_SpaceLeft()) {
+        TryToSend();
+        return false;
+      }
+      put_bytes_(Ptr, Size);
+      KickTX();
+      return true;
+    } // write
+
+    template<typename T>
+    static bool write(const T &x) {
+      return write((const uint8_t *)&x, sizeof(x));
+    } // write
+
+    static bool write_byte(uint8_t d) { return write(&d, 1); }
+    static bool write_char(int8_t d) { return write_byte((uint8_t)d); }
+    static bool write_str(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+
+    // unbuffered write. Content of Ptr should be preserved until pReleaseFunc is called, which happens after
+    // peer acknowledged all of it
+    static bool write_unbuffered(const uint8_t *Ptr, size_t Size, tReleaseFunc pReleaseFunc = nullptr) {
+      if(Size == 0) return true;
+      CloseOpenSegment();
+      if(SegsUsed() == NumSegments) {
+        TryToSend();
+        return false;
+      }
+      NewSegment(Ptr, Size, pReleaseFunc, true);
+      KickTX();
+      return true;
+    } // write_unbuffered
+
+    template<typename T>
+    static bool write_unbuffered(const T &x, tReleaseFunc pReleaseFunc = nullptr) {
+      return write_unbuffered((const uint8_t *)&x, sizeof(x), pReleaseFunc);
+    } // write_unbuffered
+
+    /// @{
+    /// TX transaction, see Port. Besides coalescing doorbells it lets buffered writes fill frames
+    static void BeginTX() { ++TX_BatchDepth; }
+    static void CommitTX() { if(--TX_BatchDepth == 0) TryToSend(); }
+
+    struct TX_Batch {
+      TX_Batch() { BeginTX(); }
+      ~TX_Batch() { CommitTX(); }
+    }; // TX_Batch
+    /// @}
+
+    /// @{
+    /// TX space, see Port. Here unbuffered block takes a segment regardless of its size
+    static constexpr size_t TX_Capacity() { return size_t(NumSegments)*MaxPayload; }
+    static constexpr size_t TX_BlockCapacity() { return NumSegments; }
+    static size_t TX_SpaceLeft() { return OpenRoom() + size_t(NumSegments - SegsUsed())*MaxPayload; }
+    static size_t TX_BlocksLeft() { return NumSegments - SegsUsed(); }
+
+    static bool HasTX_Space(size_t Bytes, size_t Blocks = 0) {
+      return SegsNeeded(Bytes, Blocks) <= TX_BlocksLeft();
+    } // HasTX_Space
+
+    /// buffered data go into segments as they are, Port_ escaping is accounted for by FrameBlocks
+    static size_t TX_EscapedBlocks(const uint8_t *, size_t) { return 0; }
+
+    template<Time_t (*TickFunction)() = millis>
+    static bool WaitForTX_Space(size_t Bytes, size_t Blocks, Time_t Timeout, void (*loop_func)() = nullptr) {
+      if(SegsNeeded(Bytes, Blocks) > NumSegments) return false;
+      TimeOut<TickFunction> T(Timeout);
+      while(!HasTX_Space(Bytes, Blocks)) {
+        TryToSend(); // space frees up only when peer acknowledges
+        if(loop_func != nullptr) loop_func();
+        if(T) return false;
+      }
+      return true;
+    } // WaitForTX_Space
+    /// @}
+
+    /// whether there are data not acknowledged yet
+    static bool SomethingToTX() { return SegsUsed() != 0 || Port_::SomethingToTX(); }
+
+    // *************** RECEPTION FUNCTIONS **************************
+    static void PurgeRX() {
+      Port_::PurgeRX();
+      BufferRX.Clear();
+    } // PurgeRX
+
+    static bool SomethingToRX() {
+      if(BufferRX.LeftToRead() == 0) ProcessLinkRX();
+      return BufferRX.LeftToRead() != 0;
+    } // SomethingToRX
+
+    static bool read(uint8_t *pd) { return SomethingToRX() && BufferRX.Read(pd); }
+
+    /// in place reading is not supported, received data are copied out of frames anyway
+    static const uint8_t *PeekRX(size_t, bool *pWait) { *pWait = false; return nullptr; }
+    static const uint8_t *PeekRX(size_t *pSize) { *pSize = 0; return nullptr; }
+    static void SkipRX(size_t) {}
+
+    /// @note !!!!! ALWAYS CHECK "SomethingToRX" FIRST
+    static uint8_t GetByte() { return BufferRX.Read_(); }
+
+    static bool GetBytes(uint8_t *p, uint32_t size, uint32_t timeout_ms) {
+      while(size--) {
+        TimeOut<> T(timeout_ms);
+        while(!SomethingToRX()) {
+          TryToSend();
+          if(T) return false;
+        }
+        if(p != nullptr) *(p++) = GetByte(); else GetByte();
+      }
+      return true;
+    } // GetBytes
+  }; // ReliablePort
+
+// following defines are just to make static variables initiation code readable, no point in using them elsewhere
+
+#define _TEMPLATE_DECL_ template<class Port_, uint8_t Log2Window, uint8_t MaxPayload, uint8_t Log2Segments, \
+                                 uint8_t Log2_RX_Buf_Size, uint16_t RetransmitTimeout>
+
+#define _TEMPLATE_SPEC_ ReliablePort<Port_, Log2Window, MaxPayload, Log2Segments, Log2_RX_Buf_Size, RetransmitTimeout>
+
+  _TEMPLATE_DECL_ uint32_t _TEMPLATE_SPEC_::Retransmits = 0;
+  _TEMPLATE_DECL_ uint32_t _TEMPLATE_SPEC_::BadFrames = 0;
+  _TEMPLATE_DECL_ typename _TEMPLATE_SPEC_::Segment _TEMPLATE_SPEC_::Segs[NumSegments];
+  _TEMPLATE_DECL_ uint8_t _TEMPLATE_SPEC_::SegRead = 0;
+  _TEMPLATE_DECL_ uint8_t _TEMPLATE_SPEC_::SegSend = 0;
+  _TEMPLATE_DECL_ uint8_t _TEMPLATE_SPEC_::SegWrite = 0;
+  _TEMPLATE_DECL_ size_t _TEMPLATE_SPEC_::SendOffset = 0;
+  _TEMPLATE_DECL_ typename _TEMPLATE_SPEC_::Frame _TEMPLATE_SPEC_::Frames[Window];
+  _TEMPLATE_DECL_ uint8_t _TEMPLATE_SPEC_::FrameBase = 0;
+  _TEMPLATE_DECL_ uint8_t _TEMPLATE_SPEC_::FrameNext = 0;
+  _TEMPLATE_DECL_ uint32_t _TEMPLATE_SPEC_::Queued = 0;
+  _TEMPLATE_DECL_ volatile uint32_t _TEMPLATE_SPEC_::Released = 0;
+  _TEMPLATE_DECL_ uint8_t _TEMPLATE_SPEC_::TX_BatchDepth = 0;
+  _TEMPLATE_DECL_ typename _TEMPLATE_SPEC_::RX_Slot _TEMPLATE_SPEC_::RX_Slots[Window];
+  _TEMPLATE_DECL_ uint8_t _TEMPLATE_SPEC_::RxNext = 0;
+  _TEMPLATE_DECL_ bool _TEMPLATE_SPEC_::AckPending = false;
+  _TEMPLATE_DECL_ CircBufferPWR2<uint8_t, Log2_RX_Buf_Size, uint16_t> _TEMPLATE_SPEC_::BufferRX;
+  _TEMPLATE_DECL_ uint8_t _TEMPLATE_SPEC_::In[3 + MaxPayload + 2];
+  _TEMPLATE_DECL_ uint16_t _TEMPLATE_SPEC_::InI = 0;
+
+#undef _TEMPLATE_DECL_
+#undef _TEMPLATE_SPEC_
+} // namespace avp
+
+#endif /* AVP_RELIABLE_PORT_HPP_ */
@@ -113,36 +113,120 @@ const char *svprintf_alloc(const char *format, va_list ap) {
 PRINTF_WRAPPER_C(const char *, sprintf_alloc, svprintf_alloc)
 
 /*
- * pointer returned by this function should not be freed after use
+ * svprintf_static formats into per-thread arenas, used in turn, so results of AVP_PRINTF_NUM_ARENAS last calls in a
+ * thread stay valid, e.g. debug_printf("%s", sprintf_static(...)) works. On hosts every arena starts as an inline
+ * buffer and grows by malloc when a string does not fit, never shrinks, so once it has grown there is a single
+ * vsnprintf per call and no allocation. Bare metal targets have one fixed buffer, output is truncated to it and malloc
+ * is not pulled in, AVP_PRINTF_NUM_ARENAS and AVP_PRINTF_GROW change that.
  */
-const char *svprintf_realloc(const char *format, va_list ap) {
-  va_list ap_;
-  va_copy(ap_, ap); // turns out vsnprintf is changing ap, so we have to make a reserve copy
-  int Size = vsnprintf(NULL, 0, format, ap_);
-  va_end(ap_);
-  if(Size < 0) return "string_vprintf: format is wrong!";
-  static char *out = NULL;
-  static size_t Reserved = 0;
-  if(Size + 1 > Reserved) out = (char *)realloc(out, Reserved = 2 * (Size + 1));
-  if(out == NULL) return "svprintf_static: failed to reallocate memory!";
-  vsprintf(out, format, ap);
-  return out; // we do not write ending 0 byte
-} // string_vprintf
+#if defined(__linux__) || defined(_WIN32) || defined(__APPLE__)
+#define AVP_PRINTF_HOST 1
+#else
+#define AVP_PRINTF_HOST 0
+#endif
+#ifndef AVP_PRINTF_ARENA_SIZE
+#define AVP_PRINTF_ARENA_SIZE 200 // initial size
+#endif
+#ifndef AVP_PRINTF_NUM_ARENAS
+#define AVP_PRINTF_NUM_ARENAS (AVP_PRINTF_HOST ? 2 : 1)
+#endif
+#ifndef AVP_PRINTF_GROW
+#define AVP_PRINTF_GROW AVP_PRINTF_HOST // arenas grow by malloc
+#endif
 
-PRINTF_WRAPPER_C(const char *, sprintf_realloc, svprintf_realloc)
+typedef struct {
+  char *p; // Initial or allocated, NULL until first use
+  size_t Size;
+  char Initial[AVP_PRINTF_ARENA_SIZE];
+} PrintfArena;
+
+static AVP_THREAD_LOCAL PrintfArena Arenas[AVP_PRINTF_NUM_ARENAS];
+static AVP_THREAD_LOCAL uint8_t CurArena = 0;
+static AVP_THREAD_LOCAL char *ReallocOut = NULL; // of svprintf_realloc
+static AVP_THREAD_LOCAL size_t ReallocSize = 0;
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+// thread_local in C has no destructors, so memory allocated by exiting threads is freed by pthread key destructor,
+// which runs in the exiting thread while its thread local variables are still there
+static pthread_key_t ThreadKey;
+static pthread_once_t ThreadKeyOnce = PTHREAD_ONCE_INIT;
+
+static void FreeThreadMemory(void *Unused) {
+  (void)Unused;
+  for(uint8_t i = 0; i < AVP_PRINTF_NUM_ARENAS; ++i)
+    if(Arenas[i].p != Arenas[i].Initial) free(Arenas[i].p);
+  free(ReallocOut);
+} // FreeThreadMemory
+
+static void MakeThreadKey(void) { pthread_key_create(&ThreadKey, FreeThreadMemory); }
+
+static void ThreadAllocated(void) {
+  pthread_once(&ThreadKeyOnce, MakeThreadKey);
+  pthread_setspecific(ThreadKey, Arenas); // any non-NULL value, so destructor is called
+} // ThreadAllocated
+#else
+static void ThreadAllocated(void) {}
+#endif
 
 /*
- * pointer returned by this function should not be freed after use
+ * pointer returned by this function should not be freed after use, it is valid until AVP_PRINTF_NUM_ARENAS more
+ * calls in the same thread
  */
 const char *svprintf_static(const char *format, va_list ap) {
-#define BUFFER_SIZE 200
-  static char Buffer[BUFFER_SIZE];
-  vsnprintf(Buffer, BUFFER_SIZE, format, ap);
-  return Buffer; // we do not write ending 0 byte
-} // string_vprintf
+  PrintfArena *a = &Arenas[CurArena];
+  if(++CurArena == AVP_PRINTF_NUM_ARENAS) CurArena = 0;
+  if(a->p == NULL) {
+    a->p = a->Initial;
+    a->Size = AVP_PRINTF_ARENA_SIZE;
+  }
+
+#if AVP_PRINTF_GROW
+  va_list ap_;
+  va_copy(ap_, ap); // we may need to format again
+  int Size = vsnprintf(a->p, a->Size, format, ap_);
+  va_end(ap_);
+  if(Size < 0) return "svprintf_static: format is wrong!";
+  if((size_t)Size < a->Size) return a->p;
+
+  // grows
+  size_t NewSize = 2 * a->Size;
+  if(NewSize < (size_t)Size + 1) NewSize = Size + 1;
+  char *p = (char *)(a->p == a->Initial ? malloc(NewSize) : realloc(a->p, NewSize));
+  if(p == NULL) return a->p; // truncated
+  if(a->p == a->Initial) ThreadAllocated();
+  a->p = p;
+  a->Size = NewSize;
+#endif
+  if(vsnprintf(a->p, a->Size, format, ap) < 0) return "svprintf_static: format is wrong!";
+  return a->p;
+} // svprintf_static
 
 PRINTF_WRAPPER_C(const char *, sprintf_static, svprintf_static)
 
+/*
+ * pointer returned by this function should not be freed after use, it is valid until the next call in the same
+ * thread. Memory is reallocated as necessary
+ */
+const char *svprintf_realloc(const char *format, va_list ap) {
+  va_list ap_;
+  va_copy(ap_, ap); // turns out vsnprintf is changing ap, so we have to make a reserve copy
+  int Size = vsnprintf(NULL, 0, format, ap_);
+  va_end(ap_);
+  if(Size < 0) return "svprintf_realloc: format is wrong!";
+  if((size_t)Size + 1 > ReallocSize) {
+    char *p = (char *)realloc(ReallocOut, 2 * ((size_t)Size + 1));
+    if(p == NULL) return "svprintf_realloc: failed to reallocate memory!";
+    if(ReallocOut == NULL) ThreadAllocated();
+    ReallocOut = p;
+    ReallocSize = 2 * ((size_t)Size + 1);
+  }
+  vsprintf(ReallocOut, format, ap);
+  return ReallocOut;
+} // svprintf_realloc
+
+PRINTF_WRAPPER_C(const char *, sprintf_realloc, svprintf_realloc)
+
 uint16_t Crc16(const uint8_t *pcBlock, long long len, uint16_t crc, uint16_t poly) {
   while(len--) {
     crc ^= ((uint16_t)*(pcBlock++)) << 8;
@@ -0,0 +1,235 @@
+/*
+ * debug_async.cpp
+ *
+ *  Author: panasyuk
+ *
+ * Host implementation of debug_putchar/debug_puts hooks (weak in common_c.c), compiled in when AVP_DEBUG_ASYNC is
+ * defined. Caller thread only copies a whole message into its own lock-free buffer, a background thread drains
+ * buffers of all threads into file descriptor with writev, so debug output can stay on while benchmarking.
+ * debug_printf and debug_vprintf are the weak ones, they format in thread-local arena and call debug_puts.
+ * Messages of a thread come out in order and never interleave with other threads' ones, order between threads is
+ * not kept. Thread waits only when its buffer is full. Buffers are written out at exit and by hang_cpu, and by
+ * debug_async_flush.
+ * AVP_DEBUG_ASYNC_FD - output file descriptor, 2 (stderr) by default, or set by debug_async_set_fd
+ * AVP_DEBUG_ASYNC_BUFFER - log2 of per-thread buffer size, 16 by default
+ * AVP_DEBUG_ASYNC_PERIOD_MS - how often background thread looks at buffers, 2 by default
+ */
+
+#if defined(AVP_DEBUG_ASYNC) && (defined(__linux__) || defined(__APPLE__))
+
+/// @cond
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+/// @endcond
+#include "Error.h"
+
+#ifndef AVP_DEBUG_ASYNC_FD
+#define AVP_DEBUG_ASYNC_FD 2
+#endif
+#ifndef AVP_DEBUG_ASYNC_BUFFER
+#define AVP_DEBUG_ASYNC_BUFFER 16
+#endif
+#ifndef AVP_DEBUG_ASYNC_PERIOD_MS
+#define AVP_DEBUG_ASYNC_PERIOD_MS 2
+#endif
+
+namespace {
+  /// single producer (owner thread), single consumer (writer thread) ring
+  struct ThreadBuffer {
+    static constexpr size_t Size = size_t(1) << AVP_DEBUG_ASYNC_BUFFER;
+    char Data[Size];
+    std::atomic<size_t> Head{0}, Tail{0}; ///< free running, Head is moved by producer, Tail by consumer
+    std::atomic<bool> Owned{true}; ///< false when thread exited, buffer is reused by a new thread
+    ThreadBuffer *pNext = nullptr; ///< list is never shrunk
+
+    size_t Free() const { return Size - (Head.load(std::memory_order_relaxed) - Tail.load(std::memory_order_acquire)); }
+  }; // ThreadBuffer
+
+  class Writer {
+    std::atomic<ThreadBuffer *> pFirst{nullptr};
+    std::atomic<int> fd{AVP_DEBUG_ASYNC_FD};
+    std::atomic<bool> Stopped{false}; ///< after exit everything is written directly
+    std::mutex Lock; ///< for Cond only, buffers are lock-free
+    std::condition_variable Cond;
+    std::atomic<unsigned> Waiting{0}; ///< threads waiting for space or flush
+    std::once_flag Started;
+    std::thread Thread;
+    bool Quit = false;
+
+    /// @return true if something was written
+    bool Drain() {
+      struct iovec V[IOV_MAX < 64?IOV_MAX:64];
+      ThreadBuffer *Bufs[sizeof(V)/sizeof(V[0])];
+      size_t Sizes[sizeof(V)/sizeof(V[0])];
+      bool Any = false;
+      for(ThreadBuffer *p = pFirst.load(std::memory_order_acquire); p != nullptr;) {
+        int n = 0, nBufs = 0;
+        for(; p != nullptr && n + 2 <= int(sizeof(V)/sizeof(V[0])); p = p->pNext) {
+          const size_t Tail = p->Tail.load(std::memory_order_relaxed);
+          const size_t Size = p->Head.load(std::memory_order_acquire) - Tail;
+          if(Size == 0) continue;
+          const size_t Start = Tail & (ThreadBuffer::Size - 1), First = ThreadBuffer::Size - Start;
+          V[n++] = {p->Data + Start, Size < First?Size:First};
+          if(Size > First) V[n++] = {p->Data, Size - First};
+          Bufs[nBufs] = p;
+          Sizes[nBufs++] = Size;
+        }
+        if(n == 0) break;
+        Any = true;
+        // writev may write less, then the rest goes with plain write, so iovecs are not recomputed
+        ssize_t Written = writev(fd.load(std::memory_order_relaxed), V, n);
+        const bool Failed = Written < 0; // nowhere to write, chunks are dropped
+        for(int i = 0, v = 0; i < nBufs; ++i) {
+          size_t Left = Sizes[i];
+          for(; Left != 0; ++v) {
+            const size_t Chunk = V[v].iov_len;
+            const size_t Done = Failed || size_t(Written) >= Chunk?Chunk:size_t(Written);
+            Written -= Done;
+            if(Done < Chunk) WriteAll((const char *)V[v].iov_base + Done, Chunk - Done);
+            Left -= Chunk;
+          }
+          Bufs[i]->Tail.store(Bufs[i]->Tail.load(std::memory_order_relaxed) + Sizes[i], std::memory_order_release);
+        }
+      }
+      return Any;
+    } // Drain
+
+    void WriteAll(const char *s, size_t Size) {
+      while(Size != 0) {
+        const ssize_t n = write(fd.load(std::memory_order_relaxed), s, Size);
+        if(n <= 0) return;
+        s += n;
+        Size -= n;
+      }
+    } // WriteAll
+
+    void Run() {
+      std::unique_lock<std::mutex> L(Lock);
+      while(!Quit) {
+        L.unlock();
+        const bool Any = Drain();
+        L.lock();
+        if(Any) Cond.notify_all(); // space for waiting producers, flush done
+        else if(!Quit) Cond.wait_for(L, std::chrono::milliseconds(AVP_DEBUG_ASYNC_PERIOD_MS));
+      }
+    } // Run
+
+    ThreadBuffer *Get() {
+      static thread_local struct Owner {
+        ThreadBuffer *p = nullptr;
+        ~Owner() { if(p != nullptr) p->Owned.store(false, std::memory_order_release); }
+      } O;
+      if(O.p == nullptr) {
+        std::call_once(Started, [this] { Thread = std::thread(&Writer::Run, this); });
+        for(ThreadBuffer *p = pFirst.load(std::memory_order_acquire); p != nullptr; p = p->pNext) {
+          bool Expected = false;
+          if(!p->Owned.load(std::memory_order_relaxed) &&
+             p->Owned.compare_exchange_strong(Expected, true, std::memory_order_acquire)) return O.p = p;
+        }
+        ThreadBuffer *p = new ThreadBuffer;
+        p->pNext = pFirst.load(std::memory_order_relaxed);
+        while(!pFirst.compare_exchange_weak(p->pNext, p, std::memory_order_release, std::memory_order_relaxed));
+        O.p = p;
+      }
+      return O.p;
+    } // Get
+
+    /// waits for writer thread to make progress
+    void WaitWriter() {
+      std::unique_lock<std::mutex> L(Lock);
+      Cond.notify_all();
+      Cond.wait_for(L, std::chrono::milliseconds(AVP_DEBUG_ASYNC_PERIOD_MS));
+    } // WaitWriter
+   public:
+    ~Writer() { Stop(); }
+
+    void Put(const char *s, size_t Size) {
+      if(Stopped.load(std::memory_order_acquire)) {
+        WriteAll(s, Size);
+        return;
+      }
+      ThreadBuffer *p = Get();
+      while(Size != 0) {
+        size_t Free;
+        while((Free = p->Free()) < (Size < ThreadBuffer::Size?Size:ThreadBuffer::Size)) { // whole message if it fits at all
+          if(Stopped.load(std::memory_order_acquire)) {
+            WriteAll(s, Size);
+            return;
+          }
+          WaitWriter();
+        }
+        const size_t n = Size < Free?Size:Free;
+        const size_t Head = p->Head.load(std::memory_order_relaxed);
+        const size_t Start = Head & (ThreadBuffer::Size - 1), First = ThreadBuffer::Size - Start;
+        if(n <= First) memcpy(p->Data + Start, s, n);
+        else {
+          memcpy(p->Data + Start, s, First);
+          memcpy(p->Data, s + First, n - First);
+        }
+        p->Head.store(Head + n, std::memory_order_release);
+        s += n;
+        Size -= n;
+      }
+    } // Put
+
+    /// returns when everything put by this thread before is written
+    void Flush() {
+      if(Stopped.load(std::memory_order_acquire)) return;
+      ThreadBuffer *p = Get();
+      while(p->Tail.load(std::memory_order_acquire) != p->Head.load(std::memory_order_relaxed)) WaitWriter();
+    } // Flush
+
+    void SetFd(int fd_) {
+      Flush();
+      fd.store(fd_, std::memory_order_relaxed);
+    } // SetFd
+
+    /// writes everything out, after that output is synchronous
+    void Stop() {
+      {
+        std::lock_guard<std::mutex> L(Lock);
+        if(Stopped.exchange(true)) return;
+        Quit = true;
+      }
+      Cond.notify_all();
+      if(Thread.joinable()) Thread.join();
+      Drain();
+    } // Stop
+  }; // Writer
+
+  Writer &GetWriter() {
+    static Writer W; // destroyed at exit, so everything gets written
+    return W;
+  } // GetWriter
+} // namespace
+
+extern "C" {
+  int debug_putchar(char c) {
+    GetWriter().Put(&c, 1);
+    return (unsigned char)c;
+  } // debug_putchar
+
+  int debug_puts(const char *s) {
+    GetWriter().Put(s, strlen(s));
+    return 0;
+  } // debug_puts
+
+  void debug_async_set_fd(int fd) { GetWriter().SetFd(fd); }
+
+  void debug_async_flush(void) { GetWriter().Flush(); }
+
+  void hang_cpu() {
+    GetWriter().Stop();
+    fflush(stderr);
+    while(1);
+  } // hang_cpu
+} // extern "C"
+
+#endif // AVP_DEBUG_ASYNC
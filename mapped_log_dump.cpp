@@ -0,0 +1,38 @@
+/*
+ * mapped_log_dump.cpp
+ *
+ *  Author: panasyuk
+ *
+ * Tool printing the last records of MappedLog file to stdout, oldest first, compiled when AVP_MAPPED_LOG_DUMP is
+ * defined:
+ *   g++ -std=c++17 -DAVP_MAPPED_LOG_DUMP mapped_log_dump.cpp -o mapped_log_dump
+ *   mapped_log_dump file [N]
+ * N is 100 by default. Records are written as they are, the number of bytes skipped as torn goes to stderr.
+ */
+
+#if defined(AVP_MAPPED_LOG_DUMP) && (defined(__linux__) || defined(__APPLE__))
+
+/// @cond
+#include <stdio.h>
+#include <stdlib.h>
+/// @endcond
+#include "MappedLog.hpp"
+
+int main(int argc, char *argv[]) {
+  if(argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: %s file [N]\n", argv[0]);
+    return 2;
+  }
+  avp::MappedLogReader R;
+  if(!R.Open(argv[1])) {
+    fprintf(stderr, "%s is not a mapped log!\n", argv[1]);
+    return 1;
+  }
+  uint64_t Skipped;
+  for(auto &Rec : R.Last(argc == 3?strtoul(argv[2], nullptr, 0):100, &Skipped))
+    fwrite(Rec.Data.data(), 1, Rec.Data.size(), stdout);
+  if(Skipped != 0) fprintf(stderr, "%llu bytes skipped\n", (unsigned long long)Skipped);
+  return 0;
+} // main
+
+#endif // AVP_MAPPED_LOG_DUMP